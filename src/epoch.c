@@ -0,0 +1,90 @@
+#include "pico/stdlib.h"
+#include "lwip/apps/sntp.h"
+#include "snowdon.h"
+#include "epoch.h"
+
+// Wall clock is kept as an offset from the free running microsecond timer, so reading it never touches the network
+static volatile int64_t epoch_offset_us;
+static volatile bool epoch_synced;
+
+/*!
+  * \brief Start periodic SNTP synchronisation, must be called with the lwIP lock held
+  */
+void epoch_sntp_init(void) {
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, SNTP_SERVER);
+    sntp_init();
+}
+
+/*!
+  * \brief Set the wall clock, called by lwIP SNTP on each successful sync
+  * \param sec Seconds since the unix epoch
+  */
+void epoch_set(uint32_t sec) {
+    epoch_offset_us = (int64_t)sec * 1000000 - (int64_t)time_us_64();
+    epoch_synced = true;
+    DEBUG_printf("epoch_set %lu\n", sec);
+}
+
+/*!
+  * \brief Check whether the wall clock has been set at least once
+  * \return true SNTP has synchronised the clock
+  * \return false Clock is unset
+  */
+bool epoch_is_synced(void) {
+    return epoch_synced;
+}
+
+/*!
+  * \brief Current wall clock time
+  * \return Seconds since the unix epoch, or 0 if the clock has not been synchronised
+  */
+uint32_t epoch_now(void) {
+    if (!epoch_synced) { return 0; }
+    return (uint32_t)(((int64_t)time_us_64() + epoch_offset_us) / 1000000);
+}
+
+/*!
+  * \brief Days since the unix epoch of a calendar date
+  * \param year Year, 1970 onwards
+  * \param month Month, 1 to 12
+  * \param day Day of the month, 1 to 31
+  * \return Days since 1970-01-01
+  */
+static uint32_t epoch_days_from_date(uint32_t year, uint32_t month, uint32_t day) {
+    // Count from March so the leap day falls at the end of the year
+    if (month <= 2) { year--; }
+    uint32_t era = year / 400;
+    uint32_t year_of_era = year - era * 400;
+    uint32_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+/*!
+  * \brief Time at which EU summer time starts or ends in a given year, 01:00 UTC on the last Sunday of the month
+  * \param year Year, 1970 onwards
+  * \param month Month of the change, 3 for the start or 10 for the end
+  * \return Seconds since the unix epoch
+  */
+static uint32_t epoch_eu_dst_change(uint32_t year, uint32_t month) {
+    uint32_t last_day = epoch_days_from_date(year, month + 1, 1) - 1;
+    // 1970-01-01 was a Thursday, so (days + 4) % 7 is the day of the week counting from Sunday
+    uint32_t last_sunday = last_day - (last_day + 4) % 7;
+    return last_sunday * 86400 + 3600;
+}
+
+/*!
+  * \brief Offset of local time from UTC at a given instant, per TZ_OFFSET_S and TZ_EU_DST
+  * \param utc Seconds since the unix epoch
+  * \return Seconds to add to UTC to get local time
+  */
+int32_t epoch_utc_offset(uint32_t utc) {
+    int32_t offset = TZ_OFFSET_S;
+    if (!TZ_EU_DST) { return offset; }
+    uint32_t days = utc / 86400;
+    uint32_t year = 1970 + days / 366;
+    while (epoch_days_from_date(year + 1, 1, 1) <= days) { year++; }
+    if (utc >= epoch_eu_dst_change(year, 3) && utc < epoch_eu_dst_change(year, 10)) { offset += 3600; }
+    return offset;
+}
\ No newline at end of file
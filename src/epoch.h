@@ -0,0 +1,33 @@
+#pragma once
+#include "pico/stdlib.h"
+
+/*!
+  * \brief Start periodic SNTP synchronisation, must be called with the lwIP lock held
+  */
+void epoch_sntp_init(void);
+
+/*!
+  * \brief Set the wall clock, called by lwIP SNTP on each successful sync
+  * \param sec Seconds since the unix epoch
+  */
+void epoch_set(uint32_t sec);
+
+/*!
+  * \brief Check whether the wall clock has been set at least once
+  * \return true SNTP has synchronised the clock
+  * \return false Clock is unset
+  */
+bool epoch_is_synced(void);
+
+/*!
+  * \brief Current wall clock time
+  * \return Seconds since the unix epoch, or 0 if the clock has not been synchronised
+  */
+uint32_t epoch_now(void);
+
+/*!
+  * \brief Offset of local time from UTC at a given instant, per TZ_OFFSET_S and TZ_EU_DST
+  * \param utc Seconds since the unix epoch
+  * \return Seconds to add to UTC to get local time
+  */
+int32_t epoch_utc_offset(uint32_t utc);
\ No newline at end of file
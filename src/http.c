@@ -1,66 +1,105 @@
 #include <string.h>
+#include <stdlib.h>
 #include "pico/cyw43_arch.h"
 #include "tcp.h"
 #include "http.h"
 #include "snowdon.h"
-#include "hardware/pio.h"
-#include "nec.pio.h"
+#include "ir.h"
+#include "epoch.h"
+#include "scheduler.h"
+#include "state.h"
+
+// Upper bound on the JSON representation of a single scheduler job / state event
+#define HTTP_JOB_JSON_MAX 160
+#define HTTP_EVENT_JSON_MAX 96
+// How long to wait for the RGB LED to change after firing a code that is expected to change it
+#define HTTP_INPUT_CHANGE_US 600000
+
+// Scratch space for building dynamic JSON bodies. lwIP callbacks never run concurrently so one buffer is shared
+static char http_json_body[BUF_SIZE - 128];
 
 /*! 
  * \brief Looks up a corresponding NEC or control value for a user provided string
  * \param code User provided string
- * \param arg TCP server state struct
+ * \param arg TCP connection state struct
  * \return A NEC infrared code or control value
  */
 static uint32_t http_code_lookup(char *code, void *arg) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
-    state->message_body->input_change_flag = false;
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
+    state->message_body.input_change_flag = false;
 
     if (!strcmp(code, "status"))        { return HTTP_CODE_LOOKUP_STATUS; }
-    if (!strcmp(code, "power")) {
-        state->message_body->input_change_flag = true;
-        return 0x807F807F;
-    }
-    if (!strcmp(code, "input")) {
-        state->message_body->input_change_flag = true;
-        return 0x807F40BF; 
+    const IR_CODE_T *ir_code = ir_code_from_name(code);
+    if (ir_code == NULL)                { return HTTP_CODE_LOOKUP_UNKNOWN_VALUE; }
+    state->message_body.input_change_flag = ir_code->input_change;
+    return ir_code->code;
+}
+
+/*!
+ * \brief Parse a user provided unsigned decimal number
+ * \param value User provided string
+ * \param out Parsed number
+ * \return true Value was a valid number
+ * \return false Value was not a valid number
+ */
+static bool http_parse_uint(const char *value, uint32_t *out) {
+    char *end;
+    if (*value < '0' || *value > '9') { return false; }
+    *out = strtoul(value, &end, 10);
+    return *end == '\0';
+}
+
+/*!
+ * \brief Store a key-value pair extracted from the url parameters or JSON body, ignoring unknown keys
+ * \param key Parameter name
+ * \param value Parameter value
+ * \param arg TCP connection state struct
+ */
+static void http_param_store(char *key, char *value, void *arg) {
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
+    uint32_t number;
+    if (key == NULL) { return; }
+    if (!strcmp(key, "code")) {
+        state->message_body.code_name = value;
+        state->message_body.code = http_code_lookup(value, arg);
+        DEBUG_printf("http_param_store code: %#x\n", state->message_body.code);
+    } else if (!strcmp(key, "at")) {
+        if (http_parse_uint(value, &number)) { state->message_body.at = number; }
+    } else if (!strcmp(key, "every")) {
+        if (http_parse_uint(value, &number)) { state->message_body.every = number; }
+    } else if (!strcmp(key, "id")) {
+        if (http_parse_uint(value, &number) && number <= INT32_MAX) { state->message_body.id = number; }
+    } else if (!strcmp(key, "offset")) {
+        if (http_parse_uint(value, &number) && number <= INT32_MAX) { state->message_body.offset = number; }
+    } else if (!strcmp(key, "since")) {
+        if (http_parse_uint(value, &number) && number <= INT32_MAX) { state->message_body.since = number; }
     }
-    if (!strcmp(code, "mute"))          { return 0x807FCC33; }
-    if (!strcmp(code, "volume_up"))     { return 0x807FC03F; }
-    if (!strcmp(code, "volume_down"))   { return 0x807F10EF; }
-    if (!strcmp(code, "previous"))      { return 0x807FA05F; }
-    if (!strcmp(code, "next"))          { return 0x807F609F; }
-    if (!strcmp(code, "play_pause"))    { return 0x807FE01F; }
-    if (!strcmp(code, "treble_up"))     { return 0x807FA45B; }
-    if (!strcmp(code, "treble_down"))   { return 0x807FE41B; }
-    if (!strcmp(code, "bass_up"))       { return 0x807F20DF; }
-    if (!strcmp(code, "bass_down"))     { return 0x807F649B; }
-    if (!strcmp(code, "pair"))          { return 0x807F906F; }
-    if (!strcmp(code, "flat"))          { return 0x807F48B7; }
-    if (!strcmp(code, "music"))         { return 0x807F946B; }
-    if (!strcmp(code, "dialog"))        { return 0x807F54AB; }
-    if (!strcmp(code, "movie"))         { return 0x807F14EB; }
-    return HTTP_CODE_LOOKUP_UNKNOWN_VALUE;
 }
 
 /*!
  * \brief Extract HTTP parameters and scrape first line of HTTP message / JSON body for user provided code variable
- * \param arg TCP server state struct
+ * \param arg TCP connection state struct
  */
 static void http_message_body_parse(void *arg) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
     if (state->buffer_recv == NULL) { return; }
-    state->message_body->method = HTTP_METHOD_POST;
-    state->message_body->url[0] = '\0';
-    state->message_body->version = HTTP_VERSION_1;
-    state->message_body->code = HTTP_CODE_LOOKUP_NO_VALUE;
+    state->message_body.method = HTTP_METHOD_POST;
+    state->message_body.url[0] = '\0';
+    state->message_body.version = HTTP_VERSION_1;
+    state->message_body.code = HTTP_CODE_LOOKUP_NO_VALUE;
+    state->message_body.code_name = NULL;
+    state->message_body.at = 0;
+    state->message_body.every = 0;
+    state->message_body.id = -1;
+    state->message_body.offset = -1;
+    state->message_body.since = -1;
 
     // Process HTTP message body, example: "PUT /?code=power HTTP/1.1"
     char *message_body = (char*)state->buffer_recv;
     char *delim = " ?=&\r";
     char next_delim;
     char current_delim = '\0';
-    char *key;
+    char *key = NULL;
     char *token;
     while(1) {
         if (*message_body == '\0') { break; }
@@ -73,20 +112,21 @@ static void http_message_body_parse(void *arg) {
         switch(current_delim) {
             case '\0':
                 DEBUG_printf("http_message_body_parse method: %s\n", token);
-                if(!strcmp(token, "GET")) { state->message_body->method = HTTP_METHOD_GET; }
-                else if(!strcmp(token, "PUT")) { state->message_body->method = HTTP_METHOD_PUT; }
-                else if(!strcmp(token, "POST")) { state->message_body->method = HTTP_METHOD_POST; }
+                if(!strcmp(token, "GET")) { state->message_body.method = HTTP_METHOD_GET; }
+                else if(!strcmp(token, "PUT")) { state->message_body.method = HTTP_METHOD_PUT; }
+                else if(!strcmp(token, "POST")) { state->message_body.method = HTTP_METHOD_POST; }
+                else if(!strcmp(token, "DELETE")) { state->message_body.method = HTTP_METHOD_DELETE; }
                 break;
             case ' ':
                 if (next_delim != '\r') {
                     DEBUG_printf("http_message_body_parse url: %s\n", token);
-                    strncpy(state->message_body->url, token, count_of(state->message_body->url));
+                    strncpy(state->message_body.url, token, count_of(state->message_body.url));
                 } else {
                     DEBUG_printf("http_message_body_parse http_ver: %s\n", token);
-                    if(!strcmp(token, "HTTP/1")) { state->message_body->version = HTTP_VERSION_1; }
-                    else if(!strcmp(token, "HTTP/1.1")) { state->message_body->version = HTTP_VERSION_1_1; }
-                    else if(!strcmp(token, "HTTP/2")) { state->message_body->version = HTTP_VERSION_2; }
-                    else if(!strcmp(token, "HTTP/3")) { state->message_body->version = HTTP_VERSION_3; }
+                    if(!strcmp(token, "HTTP/1")) { state->message_body.version = HTTP_VERSION_1; }
+                    else if(!strcmp(token, "HTTP/1.1")) { state->message_body.version = HTTP_VERSION_1_1; }
+                    else if(!strcmp(token, "HTTP/2")) { state->message_body.version = HTTP_VERSION_2; }
+                    else if(!strcmp(token, "HTTP/3")) { state->message_body.version = HTTP_VERSION_3; }
                 }
                 break;
             case '?':
@@ -96,10 +136,7 @@ static void http_message_body_parse(void *arg) {
                 break;
             case '=':
                     DEBUG_printf("http_message_body_parse value: %s\n", token);
-                    if (!strcmp(key, "code")) {
-                        state->message_body->code = http_code_lookup(token, arg);
-                        DEBUG_printf("http_message_body_parse code: %#x\n", state->message_body->code);
-                    }
+                    http_param_store(key, token, arg);
                 break; 
         }
         current_delim = next_delim;
@@ -108,7 +145,7 @@ static void http_message_body_parse(void *arg) {
         if (current_delim == '\r') { break; }
     }                   
     // Short circuit further processing if code variable has been found 
-    if (state->message_body->code != HTTP_CODE_LOOKUP_NO_VALUE) { return; }
+    if (state->message_body.code != HTTP_CODE_LOOKUP_NO_VALUE) { return; }
 
 
     // Lazy man's JSON parser, iterate over key-value pairs from JSON string, ignoring non string values. Treats JSON as a flat file.
@@ -173,47 +210,272 @@ static void http_message_body_parse(void *arg) {
         *message_body = '\0';  // token = 'power'
         DEBUG_printf("http_message_body_parse value: %s\n", token);
 
-        // Validate that the key associated with this value is the one we want. If so, capture the value and return
-        if (!strcmp(key, "code")) { 
-            state->message_body->code = http_code_lookup(token, arg); 
-            DEBUG_printf("http_message_body_parse code: %llu\n", state->message_body->code);
-            return; 
-        }
+        // Capture the value if the key associated with it is one we care about
+        http_param_store(key, token, arg);
         message_body++;
     }
 }
 
 /*!
   * \brief Helper method for generating a JSON HTTP response
-  * \param arg TCP server state struct
+  * \param arg TCP connection state struct
   * \param json_body JSON string containing response message
   * \param http_status HTTP status code and text
   */
 static void http_generate_response(void *arg, const char *json_body, const char *http_status) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
     state->payload_len = sprintf((char*)state->buffer_send, 
         "HTTP/1.1 %s\r\nContent-Length: %d\r\n\r\n%s", http_status, strlen(json_body), json_body);
 }
 
+/*!
+  * \brief Append the JSON representation of a scheduler job to a string
+  * \param json String to write to, must have room for HTTP_JOB_JSON_MAX bytes
+  * \param id Job id
+  * \param job Scheduler job
+  * \return Number of bytes written
+  */
+static int http_job_json(char *json, int id, const SCHEDULER_JOB_T *job) {
+    int len = sprintf(json, "{\"id\": %d, \"at\": %lu, \"every\": %lu, \"code\": \"", id, job->fire_at, job->period_s);
+    for (uint8_t i = 0; i < job->code_count; i++) {
+        const IR_CODE_T *ir_code = ir_code_from_value(job->codes[i]);
+        if (i > 0) { json[len++] = ','; }
+        if (ir_code != NULL) {
+            len += sprintf(json + len, "%s", ir_code->name);
+        } else {
+            len += sprintf(json + len, "%#lx", job->codes[i]);
+        }
+    }
+    len += sprintf(json + len, "\"}");
+    return len;
+}
+
+/*!
+  * \brief List scheduler jobs, or a single job if an id is provided. Lists are paginated to fit the send buffer,
+  *        a "next" value is returned when further jobs remain which can be passed back as the offset variable
+  * \param arg TCP connection state struct
+  */
+static void http_schedule_list(void *arg) {
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
+    int len;
+    if (state->message_body.id >= 0) {
+        const SCHEDULER_JOB_T *job = scheduler_get(state->message_body.id);
+        if (job == NULL) {
+            http_generate_response(arg, "{\"message\": \"job not found\"}\n", "400 Bad Request");
+            return;
+        }
+        len = http_job_json(http_json_body, state->message_body.id, job);
+        sprintf(http_json_body + len, "\n");
+        http_generate_response(arg, http_json_body, "200 OK");
+        return;
+    }
+
+    len = sprintf(http_json_body, "{\"time\": %lu, \"synced\": %s, \"jobs\": [", epoch_now(), 
+                  epoch_is_synced() ? "true" : "false");
+    int id = scheduler_next(state->message_body.offset < 0 ? 0 : state->message_body.offset);
+    while (id >= 0) {
+        // Leave room for the separator and closing brackets / next value
+        if (len + HTTP_JOB_JSON_MAX + 32 > sizeof(http_json_body)) { break; }
+        if (http_json_body[len - 1] == '}') { len += sprintf(http_json_body + len, ", "); }
+        len += http_job_json(http_json_body + len, id, scheduler_get(id));
+        id = scheduler_next(id + 1);
+    }
+    if (id >= 0) {
+        sprintf(http_json_body + len, "], \"next\": %d}\n", id);
+    } else {
+        sprintf(http_json_body + len, "]}\n");
+    }
+    http_generate_response(arg, http_json_body, "200 OK");
+}
+
+/*!
+  * \brief Manage on-device scheduled jobs. GET lists jobs, PUT creates a job firing one or more comma separated codes
+  *        at a given time and optionally every n seconds thereafter, DELETE removes a job by id
+  * \param arg TCP connection state struct
+  */
+static void http_process_schedule(void *arg) {
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
+
+    if (state->message_body.method == HTTP_METHOD_GET) {
+        http_schedule_list(arg);
+        return;
+    }
+
+    if (state->message_body.method == HTTP_METHOD_DELETE) {
+        if (state->message_body.id < 0) {
+            http_generate_response(arg, "{\"message\": \"id variable required\"}\n", "400 Bad Request");
+            return;
+        }
+        if (!scheduler_remove(state->message_body.id)) {
+            http_generate_response(arg, "{\"message\": \"job not found\"}\n", "400 Bad Request");
+            return;
+        }
+        http_generate_response(arg, "{\"status\": \"ok\"}\n", "200 OK");
+        return;
+    }
+
+    if (state->message_body.method != HTTP_METHOD_PUT) {
+        http_generate_response(arg, "{\"message\": \"HTTP method not supported\"}\n", "400 Bad Request");
+        return;
+    }
+
+    if (state->message_body.code_name == NULL) {
+        http_generate_response(arg, "{\"message\": \"code variable required\"}\n", "400 Bad Request");
+        return;
+    }
+
+    if (state->message_body.at == 0) {
+        http_generate_response(arg, "{\"message\": \"at variable required\"}\n", "400 Bad Request");
+        return;
+    }
+
+    if (epoch_is_synced() && state->message_body.at < epoch_now()) {
+        http_generate_response(arg, "{\"message\": \"at must be in the future\"}\n", "400 Bad Request");
+        return;
+    }
+
+    // Code may be a comma separated batch, e.g. "power,volume_down,volume_down"
+    uint32_t codes[SCHEDULER_MAX_CODES];
+    uint8_t code_count = 0;
+    char *name = strtok(state->message_body.code_name, ",");
+    while (name != NULL) {
+        const IR_CODE_T *ir_code = ir_code_from_name(name);
+        if (ir_code == NULL) {
+            http_generate_response(arg, "{\"message\": \"code not recognised\"}\n", "400 Bad Request");
+            return;
+        }
+        if (code_count == SCHEDULER_MAX_CODES) {
+            http_generate_response(arg, "{\"message\": \"too many codes\"}\n", "400 Bad Request");
+            return;
+        }
+        codes[code_count++] = ir_code->code;
+        name = strtok(NULL, ",");
+    }
+
+    if (code_count == 0) {
+        http_generate_response(arg, "{\"message\": \"code variable required\"}\n", "400 Bad Request");
+        return;
+    }
+
+    int id = scheduler_add(state->message_body.at, state->message_body.every, codes, code_count);
+    if (id < 0) {
+        http_generate_response(arg, "{\"message\": \"schedule full\"}\n", "500 Internal Server Error");
+        return;
+    }
+    sprintf(http_json_body, "{\"id\": %d}\n", id);
+    http_generate_response(arg, http_json_body, "200 OK");
+}
+
+/*!
+  * \brief Respond to an /events long-poll with the current state and every event newer than the clients since value.
+  *        The returned seq value can be passed back as since to continue from where this response left off
+  * \param arg TCP connection state struct
+  * \param force Respond even if there are no new events, used when the long-poll times out
+  * \return true A response was generated
+  * \return false No new events, the connection should keep waiting
+  */
+bool http_events_respond(void *arg, bool force) {
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
+    const STATE_EVENT_T *event = state_event_after(state->message_body.since);
+    if (event == NULL && !force) { return false; }
+
+    uint32_t seq = state_event_seq();
+    int len = sprintf(http_json_body, "{\"volume\": %ld, \"eq\": \"%s\", \"events\": [", 
+                      state_volume(), state_eq_name(state_eq()));
+    while (event != NULL) {
+        // Leave room for the separator and closing brackets / seq value
+        if (len + HTTP_EVENT_JSON_MAX + 32 > sizeof(http_json_body)) { break; }
+        if (http_json_body[len - 1] == '}') { len += sprintf(http_json_body + len, ", "); }
+        const IR_CODE_T *ir_code = ir_code_from_value(event->code);
+        if (ir_code != NULL) {
+            len += sprintf(http_json_body + len, "{\"seq\": %lu, \"code\": \"%s\"", event->seq, ir_code->name);
+        } else {
+            len += sprintf(http_json_body + len, "{\"seq\": %lu, \"code\": \"%#lx\"", event->seq, event->code);
+        }
+        len += sprintf(http_json_body + len, ", \"source\": \"%s\", \"timestamp_us\": %llu}",
+                       event->source == STATE_SOURCE_REMOTE ? "remote" : "device", event->timestamp_us);
+        seq = event->seq;
+        event = state_event_after(event->seq);
+    }
+    sprintf(http_json_body + len, "], \"seq\": %lu}\n", seq);
+
+    state->event_wait = false;
+    http_generate_response(arg, http_json_body, "200 OK");
+    return true;
+}
+
+/*!
+  * \brief Respond to a code request once its frame has left the IR line, reporting how long that took. Where the code
+  *        is expected to change the input, also wait for a state change to show on the RGB LED
+  * \param arg TCP connection state struct
+  * \param force Respond even if the frame or input change is still outstanding, used when the connection times out
+  * \return true A response was generated
+  * \return false Still waiting, the connection should keep waiting
+  */
+bool http_code_respond(void *arg, bool force) {
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
+    uint64_t done_us;
+    bool done = ir_frame_done(state->frame_wait, &done_us);
+
+    // Ensure a state change occurs on GPIO after firing NEC code, waiting up to 600ms
+    bool changed = true;
+    if (done && state->message_body.input_change_flag) {
+        changed = ((gpio_get_all() & RGB_MASK) >> RGB_BASE_PIN) != state->last_gpio;
+        if (!changed && time_us_64() - done_us < HTTP_INPUT_CHANGE_US && !force) { return false; }
+    }
+    if (!done && !force) { return false; }
+
+    state->frame_wait = 0;
+    state->message_body.input_change_flag = false;
+    if (!done || !changed) {
+        http_generate_response(arg, "{\"status\": \"ng\"}\n", "500 Internal Server Error");
+        return true;
+    }
+    sprintf(http_json_body, "{\"status\": \"ok\", \"latency_us\": %llu}\n", done_us - state->frame_sent_us);
+    http_generate_response(arg, http_json_body, "200 OK");
+    return true;
+}
+
 /*!
   * \brief Extract parameters, react and then respond to a HTTP request.
   * \internal Where the code variable resolves to a NEC value, the value will be fired on the devices IR line.
   * \internal Where the code variable resolves to a status control value, the RGB LED on the device will be queried and state returned
-  * \param arg TCP server state struct
+  * \param arg TCP connection state struct
   */
 void http_process_recv_data(void *arg) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
     http_message_body_parse(arg);
-    if (state->message_body->version != HTTP_VERSION_1_1) {
+    if (state->message_body.version != HTTP_VERSION_1_1) {
         http_generate_response(arg, "{\"message\": \"HTTP version must be 1.1\"}\n", "400 Bad Request");
         return;
     }
+
+    if (!strcmp(state->message_body.url, "/schedule")) {
+        http_process_schedule(arg);
+        return;
+    }
+
+    if (!strcmp(state->message_body.url, "/events")) {
+        if (state->message_body.method != HTTP_METHOD_GET) {
+            http_generate_response(arg, "{\"message\": \"HTTP method not supported\"}\n", "400 Bad Request");
+            return;
+        }
+        // Without a since value, wait for the next event
+        if (state->message_body.since < 0) { state->message_body.since = state_event_seq(); }
+        if (http_events_respond(arg, false)) { return; }
+        if (tcp_server_event_waiters() >= TCP_MAX_EVENT_WAITERS) {
+            http_generate_response(arg, "{\"message\": \"Too many event listeners\"}\n", "503 Service Unavailable");
+            return;
+        }
+        state->event_wait = true;
+        return;
+    }
     
-    if (strcmp(state->message_body->url, "/")) {
+    if (strcmp(state->message_body.url, "/")) {
         http_generate_response(arg, "{\"message\": \"Endpoint not found\"}\n", "400 Bad Request");
         return;
     }
-    if (state->message_body->method == HTTP_METHOD_GET) {
+    if (state->message_body.method == HTTP_METHOD_GET) {
         http_generate_response(arg, "{\"code\": ["
                 "\"status\", "
                 "\"power\", "
@@ -237,72 +499,72 @@ void http_process_recv_data(void *arg) {
         return;
     }
 
-    if (state->message_body->method != HTTP_METHOD_PUT) {
+    if (state->message_body.method != HTTP_METHOD_PUT) {
         http_generate_response(arg, "{\"message\": \"HTTP method not supported\"}\n", "400 Bad Request");
         return;
     }
     
-    if (state->message_body->code > HTTP_CODE_LOOKUP_NO_VALUE) {
-        uint32_t last_gpio;
-
+    if (state->message_body.code > HTTP_CODE_LOOKUP_NO_VALUE) {
         // Record state of GPIO before firing NEC code if it is expected to change
-        if (state->message_body->input_change_flag) {
-            last_gpio = (gpio_get_all() & RGB_MASK) >> RGB_BASE_PIN;
+        if (state->message_body.input_change_flag) {
+            state->last_gpio = (gpio_get_all() & RGB_MASK) >> RGB_BASE_PIN;
         }
-        pio_sm_put_blocking(PIO_INSTANCE, 0, state->message_body->code);
-        http_generate_response(arg, "{\"status\": \"ok\"}\n", "200 OK");
-
-        // Ensure a state change occurs on GPIO after firing NEC code, waiting up to 600ms (50ms * 12)
-        if (state->message_body->input_change_flag) {
-            uint8_t i = 0;
-            while(1) {
-                uint32_t gpio = (gpio_get_all() & RGB_MASK) >> RGB_BASE_PIN;
-                if (last_gpio != gpio) {break;}
-                if (i++ > 12) {
-                    http_generate_response(arg, "{\"status\": \"ng\"}\n", "500 Internal Server Error");
-                    break;
-                }
-                busy_wait_ms(50);
-            }
-            state->message_body->input_change_flag = false;
-        } 
+        state->frame_sent_us = time_us_64();
+        state->frame_wait = ir_send(state->message_body.code);
+        if (state->frame_wait == 0) {
+            http_generate_response(arg, "{\"message\": \"IR queue full\"}\n", "503 Service Unavailable");
+            return;
+        }
+        // Nothing to send yet, tcp_server_notify_frames() responds once the frame has left the IR line
         return;
     }
 
-    if (state->message_body->code == HTTP_CODE_LOOKUP_STATUS) {
+    if (state->message_body.code == HTTP_CODE_LOOKUP_STATUS) {
         uint32_t gpio;
+        const char *onoff = "on";
+        const char *input = NULL;
         do{
             gpio = (gpio_get_all() & RGB_MASK) >> RGB_BASE_PIN;
             switch(gpio) {
                 case 0b110: // red
-                    http_generate_response(arg, "{\"onoff\": \"off\", \"input\": \"off\"}\n", "200 OK");
+                    onoff = "off";
+                    input = "off";
                     break;
                 case 0b100: // yellow
-                    http_generate_response(arg, "{\"onoff\": \"on\", \"input\": \"optical\"}\n", "200 OK");
+                    input = "optical";
                     break;
                 case 0b000: // white
-                    http_generate_response(arg, "{\"onoff\": \"on\", \"input\": \"aux\"}\n", "200 OK");
+                    input = "aux";
                     break;
                 case 0b101: // green
-                    http_generate_response(arg, "{\"onoff\": \"on\", \"input\": \"line-in\"}\n", "200 OK");
+                    input = "line-in";
                     break;
                 case 0b011: // blue
-                    http_generate_response(arg, "{\"onoff\": \"on\", \"input\": \"bluetooth\"}\n", "200 OK");
+                    input = "bluetooth";
                     break;
                 case 0b111: // off (likely in a transitioning state)
                     busy_wait_ms(50);
                     continue;
             }
         } while (gpio == 0b111);
+        if (input == NULL) {
+            http_generate_response(arg, "{\"message\": \"unrecognised LED state\"}\n", "500 Internal Server Error");
+            return;
+        }
+
+        // Volume and EQ are not observable on the device, so come from the state model fed by the IR line
+        sprintf(http_json_body, "{\"onoff\": \"%s\", \"input\": \"%s\", \"volume\": %ld, \"eq\": \"%s\"}\n",
+                onoff, input, state_volume(), state_eq_name(state_eq()));
+        http_generate_response(arg, http_json_body, "200 OK");
         return;
     }
     
-    if (state->message_body->code == HTTP_CODE_LOOKUP_UNKNOWN_VALUE) {
+    if (state->message_body.code == HTTP_CODE_LOOKUP_UNKNOWN_VALUE) {
         http_generate_response(arg, "{\"message\": \"code not recognised\"}\n", "400 Bad Request");
         return;
     }
 
-    if (state->message_body->code == HTTP_CODE_LOOKUP_NO_VALUE) {
+    if (state->message_body.code == HTTP_CODE_LOOKUP_NO_VALUE) {
         http_generate_response(arg, "{\"message\": \"code variable required\"}\n", "400 Bad Request");
         return;
     }
@@ -5,7 +5,8 @@
 typedef enum HTTP_METHOD_T_ {
     HTTP_METHOD_GET,
     HTTP_METHOD_POST,
-    HTTP_METHOD_PUT
+    HTTP_METHOD_PUT,
+    HTTP_METHOD_DELETE
 } HTTP_METHOD_T;
 
 typedef enum HTTP_VERSION_T_ {
@@ -27,11 +28,34 @@ typedef struct HTTP_MESSAGE_BODY_T_ {
     char url[20];
     uint32_t code;
     bool input_change_flag;
+    char *code_name;    // Raw code value, points into the receive buffer
+    uint32_t at;        // Seconds since the unix epoch, 0 if not provided
+    uint32_t every;     // Seconds between firings, 0 if not provided
+    int32_t id;         // Job id, -1 if not provided
+    int32_t offset;     // Job id to start listing from, -1 if not provided
+    int32_t since;      // Event sequence number to report events after, -1 if not provided
 } HTTP_MESSAGE_BODY_T;
 
 /*!
   * \brief Extract parameters, react and then respond to a HTTP request.
-  * \param arg TCP server state struct
+  * \param arg TCP connection state struct
   */
 void http_process_recv_data(void *arg);
-   
+
+/*!
+  * \brief Respond to an /events long-poll with the current state and every event newer than the clients since value.
+  * \param arg TCP connection state struct
+  * \param force Respond even if there are no new events, used when the long-poll times out
+  * \return true A response was generated
+  * \return false No new events, the connection should keep waiting
+  */
+bool http_events_respond(void *arg, bool force);
+
+/*!
+  * \brief Respond to a code request once its frame has left the IR line, reporting how long that took
+  * \param arg TCP connection state struct
+  * \param force Respond even if the frame or input change is still outstanding, used when the connection times out
+  * \return true A response was generated
+  * \return false Still waiting, the connection should keep waiting
+  */
+bool http_code_respond(void *arg, bool force);
\ No newline at end of file
@@ -0,0 +1,313 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "hardware/dma.h"
+#include "hardware/sync.h"
+#include "nec.pio.h"
+#include "snowdon.h"
+#include "state.h"
+#include "ir.h"
+
+#ifdef IR_BENCH
+#include "hardware/structs/systick.h"
+volatile IR_BENCH_T ir_bench;
+// SysTick counts down from 0xFFFFFF at the system clock, so elapsed cycles are start - end modulo 24 bits
+#define IR_BENCH_START() uint32_t ir_bench_start = systick_hw->cvr
+#define IR_BENCH_END(counter) ir_bench.counter += (ir_bench_start - systick_hw->cvr) & 0xFFFFFF
+#else
+#define IR_BENCH_START()
+#define IR_BENCH_END(counter)
+#endif
+
+typedef struct IR_FRAME_T_ {
+    uint32_t code;
+    uint64_t timestamp_us;
+} IR_FRAME_T;
+
+// Decoded frames, written by the receive IRQ and drained by ir_receive_poll()
+static IR_FRAME_T ir_rx_frames[IR_RX_QUEUE];
+static volatile uint32_t ir_rx_head;
+static volatile uint32_t ir_rx_tail;
+// Last code applied from the IR line, re-applied for each repeat frame whilst the button is held
+static uint32_t ir_rx_last_code = IR_CODE_REPEAT;
+static uint64_t ir_rx_last_us;
+
+// Frames queued for transmission. Frame n (numbered from 1) lives in slot (n - 1) % IR_TX_QUEUE until it completes
+static uint32_t ir_tx_ring[IR_TX_QUEUE] __attribute__((aligned(IR_TX_QUEUE * sizeof(uint32_t))));
+static uint64_t ir_tx_done_us[IR_TX_QUEUE];
+static bool ir_tx_apply[IR_TX_QUEUE];    // Frame is applied to the state model once it finishes
+static volatile uint32_t ir_tx_head;     // Frames queued
+static volatile uint32_t ir_tx_dma_pos;  // Frames handed to DMA
+static volatile uint32_t ir_tx_done;     // Frames finished on the IR line
+static int ir_tx_dma;
+// Last frame to finish on the IR line, so its echo is still recognised if the receive IRQ is serviced after the frame IRQ
+static uint32_t ir_tx_last_code;
+static uint64_t ir_tx_last_us;
+
+// Finished frames to apply to the state model, written by the frame IRQ and drained by ir_transmit_poll()
+static IR_FRAME_T ir_tx_frames[IR_TX_QUEUE];
+static volatile uint32_t ir_tx_frames_head;
+static volatile uint32_t ir_tx_frames_tail;
+
+static const IR_CODE_T ir_codes[] = {
+    {"power",       IR_CODE_POWER,       true},
+    {"input",       IR_CODE_INPUT,       true},
+    {"mute",        IR_CODE_MUTE,        false},
+    {"volume_up",   IR_CODE_VOLUME_UP,   false},
+    {"volume_down", IR_CODE_VOLUME_DOWN, false},
+    {"previous",    IR_CODE_PREVIOUS,    false},
+    {"next",        IR_CODE_NEXT,        false},
+    {"play_pause",  IR_CODE_PLAY_PAUSE,  false},
+    {"treble_up",   IR_CODE_TREBLE_UP,   false},
+    {"treble_down", IR_CODE_TREBLE_DOWN, false},
+    {"bass_up",     IR_CODE_BASS_UP,     false},
+    {"bass_down",   IR_CODE_BASS_DOWN,   false},
+    {"pair",        IR_CODE_PAIR,        false},
+    {"flat",        IR_CODE_FLAT,        false},
+    {"music",       IR_CODE_MUSIC,       false},
+    {"dialog",      IR_CODE_DIALOG,      false},
+    {"movie",       IR_CODE_MOVIE,       false},
+};
+
+/*!
+  * \brief Hand any queued frames not yet given to DMA over in a single transfer, if the channel is idle.
+  *        Must be called with interrupts disabled or from the frame IRQ
+  */
+static void ir_tx_dma_kick(void) {
+    IR_BENCH_START();
+    uint32_t pending = ir_tx_head - ir_tx_dma_pos;
+    if (pending != 0 && !dma_channel_is_busy(ir_tx_dma)) {
+        dma_channel_transfer_from_buffer_now(ir_tx_dma, &ir_tx_ring[ir_tx_dma_pos % IR_TX_QUEUE], pending);
+        ir_tx_dma_pos += pending;
+    }
+    IR_BENCH_END(kick_cycles);
+}
+
+/*!
+  * \brief Called from the nec program once a frame has fully left the IR line. Timestamps the frame, queues it for
+  *        ir_transmit_poll() and restarts DMA if frames were queued whilst the previous transfer was still running
+  */
+static void ir_tx_irq_handler(void) {
+    IR_BENCH_START();
+    uint64_t timestamp_us = time_us_64();
+    uint32_t slot = ir_tx_done % IR_TX_QUEUE;
+    // The nec program stalls until its completion flag is cleared, so each frame raises exactly one IRQ
+    pio_interrupt_clear(PIO_INSTANCE, IR_TX_SM);
+    ir_tx_done_us[slot] = timestamp_us;
+    ir_tx_last_code = ir_tx_ring[slot];
+    ir_tx_last_us = timestamp_us;
+    if (ir_tx_apply[slot] && ir_tx_frames_head - ir_tx_frames_tail < IR_TX_QUEUE) {
+        ir_tx_frames[ir_tx_frames_head % IR_TX_QUEUE] = (IR_FRAME_T){ir_tx_ring[slot], timestamp_us};
+        ir_tx_frames_head++;
+    }
+    ir_tx_done++;
+    ir_tx_dma_kick();
+    IR_BENCH_END(irq_cycles);
+}
+
+/*!
+  * \brief Timestamp frames as they are decoded and queue them for ir_receive_poll()
+  */
+static void ir_rx_irq_handler(void) {
+    IR_BENCH_START();
+    while (!pio_sm_is_rx_fifo_empty(PIO_INSTANCE, IR_RX_SM)) {
+        uint32_t code = pio_sm_get(PIO_INSTANCE, IR_RX_SM);
+        uint64_t timestamp_us = time_us_64();
+        // Drop our own transmissions, they are applied by ir_transmit_poll(), and drop frames if the queue is full.
+        // Whilst interrupts are held off, e.g. by a flash erase, both IRQs can become pending together and the frame IRQ
+        // is serviced first, so a frame is also ours if its IRQ is still pending or it matches the frame that just finished
+        if (ir_tx_done != ir_tx_head || pio_interrupt_get(PIO_INSTANCE, IR_TX_SM)) { continue; }
+        if (code == ir_tx_last_code && timestamp_us - ir_tx_last_us <= IR_FRAME_US) { continue; }
+        if (ir_rx_head - ir_rx_tail == IR_RX_QUEUE) { continue; }
+        ir_rx_frames[ir_rx_head % IR_RX_QUEUE] = (IR_FRAME_T){code, timestamp_us};
+        ir_rx_head++;
+    }
+    IR_BENCH_END(rx_cycles);
+}
+
+/*!
+  * \brief Load the NEC programs into PIO and start the transmit and receive state machines
+  */
+void ir_init(void) {
+    pio_sm_claim(PIO_INSTANCE, IR_TX_SM);
+    pio_sm_claim(PIO_INSTANCE, IR_RX_SM);
+
+    uint nec_offset = pio_add_program(PIO_INSTANCE, &nec_program);
+    nec_program_init(PIO_INSTANCE, IR_TX_SM, nec_offset, IR_PIN);
+
+    // DMA feeds the transmit FIFO from the queue, wrapping its read address around the ring
+    ir_tx_dma = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(ir_tx_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_ring(&c, false, __builtin_ctz(sizeof(ir_tx_ring)));
+    channel_config_set_dreq(&c, pio_get_dreq(PIO_INSTANCE, IR_TX_SM, true));
+    dma_channel_configure(ir_tx_dma, &c, &PIO_INSTANCE->txf[IR_TX_SM], ir_tx_ring, 0, false);
+
+    irq_set_exclusive_handler(IR_TX_IRQ, ir_tx_irq_handler);
+    pio_set_irq0_source_enabled(PIO_INSTANCE, (enum pio_interrupt_source)(pis_interrupt0 + IR_TX_SM), true);
+    irq_set_enabled(IR_TX_IRQ, true);
+
+    if (IR_RX_PIN != IR_PIN) {
+        gpio_init(IR_RX_PIN);
+        gpio_pull_up(IR_RX_PIN);
+    }
+    uint nec_receive_offset = pio_add_program(PIO_INSTANCE, &nec_receive_program);
+    nec_receive_program_init(PIO_INSTANCE, IR_RX_SM, nec_receive_offset, IR_RX_PIN);
+
+    irq_set_exclusive_handler(IR_RX_IRQ, ir_rx_irq_handler);
+    pio_set_irq1_source_enabled(PIO_INSTANCE, (enum pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + IR_RX_SM), true);
+    irq_set_enabled(IR_RX_IRQ, true);
+}
+
+/*!
+  * \brief Look up a NEC code by its user facing name
+  * \param name User provided string
+  * \return Matching code entry, or NULL if the name is not recognised
+  */
+const IR_CODE_T* ir_code_from_name(const char *name) {
+    for (uint i = 0; i < count_of(ir_codes); i++) {
+        if (!strcmp(ir_codes[i].name, name)) { return &ir_codes[i]; }
+    }
+    return NULL;
+}
+
+/*!
+  * \brief Look up the user facing name of a NEC code
+  * \param code NEC infrared code
+  * \return Matching code entry, or NULL if the code is not recognised
+  */
+const IR_CODE_T* ir_code_from_value(uint32_t code) {
+    for (uint i = 0; i < count_of(ir_codes); i++) {
+        if (ir_codes[i].code == code) { return &ir_codes[i]; }
+    }
+    return NULL;
+}
+
+/*!
+  * \brief Number of frames that can be queued before the transmit queue is full
+  */
+uint ir_transmit_free(void) {
+    return IR_TX_QUEUE - (ir_tx_head - ir_tx_done);
+}
+
+/*!
+  * \brief Queue frames for transmission by DMA. Never blocks, either every code is queued or none are
+  * \param codes NEC infrared codes to transmit in order
+  * \param count Number of codes
+  * \param apply Apply each frame to the state model once it has left the IR line
+  * \return Sequence number of the last queued frame, or 0 if the transmit queue does not have room for every code
+  */
+static uint32_t ir_queue(const uint32_t *codes, uint count, bool apply) {
+    IR_BENCH_START();
+    uint32_t seq = 0;
+    if (count <= ir_transmit_free()) {
+        for (uint i = 0; i < count; i++) {
+            ir_tx_ring[ir_tx_head % IR_TX_QUEUE] = codes[i];
+            ir_tx_apply[ir_tx_head % IR_TX_QUEUE] = apply;
+            __compiler_memory_barrier();
+            ir_tx_head++;
+        }
+        uint32_t ints = save_and_disable_interrupts();
+        ir_tx_dma_kick();
+        restore_interrupts(ints);
+        seq = ir_tx_head;
+    }
+    IR_BENCH_END(transmit_cycles);
+    return seq;
+}
+
+/*!
+  * \brief Queue frames for transmission by DMA without touching the state model. Never blocks, either every code
+  *        is queued or none are
+  * \param codes NEC infrared codes to transmit in order
+  * \param count Number of codes
+  * \return Sequence number of the last queued frame, or 0 if the transmit queue does not have room for every code
+  */
+uint32_t ir_transmit(const uint32_t *codes, uint count) {
+    return ir_queue(codes, count, false);
+}
+
+/*!
+  * \brief Fire a sequence of NEC codes on the devices IR line. Each code is applied to the state model by
+  *        ir_transmit_poll() once its frame has left the line. Must be called with the lwIP lock held
+  * \param codes NEC infrared codes to fire in order
+  * \param count Number of codes
+  * \return Sequence number of the last queued frame, or 0 if the transmit queue does not have room for every code
+  */
+uint32_t ir_send_sequence(const uint32_t *codes, uint count) {
+    return ir_queue(codes, count, true);
+}
+
+/*!
+  * \brief Fire a NEC code on the devices IR line, it is applied to the state model by ir_transmit_poll() once its
+  *        frame has left the line. Must be called with the lwIP lock held
+  * \param code NEC infrared code
+  * \return Sequence number of the queued frame, or 0 if the transmit queue is full
+  */
+uint32_t ir_send(uint32_t code) {
+    return ir_send_sequence(&code, 1);
+}
+
+/*!
+  * \brief Number of frames that have finished on the IR line since boot
+  */
+uint32_t ir_frames_done(void) {
+    return ir_tx_done;
+}
+
+/*!
+  * \brief Check whether a queued frame has finished on the IR line, without blocking
+  * \param seq Sequence number returned when the frame was queued
+  * \param done_us Set to the time the frame finished, in microseconds since boot. May be NULL
+  * \return true Frame has finished
+  * \return false Frame is still queued or being sent
+  */
+bool ir_frame_done(uint32_t seq, uint64_t *done_us) {
+    if ((int32_t)(ir_tx_done - seq) < 0) { return false; }
+    if (done_us != NULL) { *done_us = ir_tx_done_us[(seq - 1) % IR_TX_QUEUE]; }
+    return true;
+}
+
+/*!
+  * \brief Apply frames fired by ir_send_sequence() that have finished since the last call to the state model,
+  *        timestamped with the time each left the IR line. Must be called with the lwIP lock held
+  * \return Number of frames applied
+  */
+uint ir_transmit_poll(void) {
+    uint count = 0;
+    while (ir_tx_frames_tail != ir_tx_frames_head) {
+        IR_FRAME_T *frame = &ir_tx_frames[ir_tx_frames_tail % IR_TX_QUEUE];
+        state_apply(frame->code, frame->timestamp_us, STATE_SOURCE_DEVICE);
+        ir_tx_frames_tail++;
+        count++;
+    }
+    return count;
+}
+
+/*!
+  * \brief Apply frames decoded from the IR line since the last call to the state model, repeat frames re-apply
+  *        the last decoded code. Must be called with the lwIP lock held
+  * \return Number of frames applied
+  */
+uint ir_receive_poll(void) {
+    uint count = 0;
+    while (ir_rx_tail != ir_rx_head) {
+        IR_FRAME_T *frame = &ir_rx_frames[ir_rx_tail % IR_RX_QUEUE];
+        uint32_t code = frame->code;
+        if (code == IR_CODE_REPEAT) {
+            // Ignore repeats that do not follow on from a decoded frame, e.g. the frame itself was dropped
+            code = frame->timestamp_us - ir_rx_last_us <= IR_REPEAT_US ? ir_rx_last_code : IR_CODE_REPEAT;
+        }
+        if (code != IR_CODE_REPEAT) {
+            state_apply(code, frame->timestamp_us, STATE_SOURCE_REMOTE);
+            ir_rx_last_code = code;
+            ir_rx_last_us = frame->timestamp_us;
+            count++;
+        }
+        ir_rx_tail++;
+    }
+    return count;
+}
\ No newline at end of file
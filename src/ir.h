@@ -0,0 +1,129 @@
+#pragma once
+#include "pico/stdlib.h"
+
+#define IR_TX_SM 0
+#define IR_TX_IRQ PIO0_IRQ_0
+// Power of two, the transmit queue is a ring read by DMA with address wrapping
+#define IR_TX_QUEUE 32
+#define IR_RX_SM 1
+#define IR_RX_IRQ PIO0_IRQ_1
+#define IR_RX_QUEUE 16
+// Longest frame the nec program can emit, including its leading idle period
+#define IR_FRAME_US 96000
+// Repeat frames follow every 108ms whilst a button is held, allow some slack before treating one as stray
+#define IR_REPEAT_US 150000
+
+#define IR_CODE_POWER       0x807F807F
+#define IR_CODE_INPUT       0x807F40BF
+#define IR_CODE_MUTE        0x807FCC33
+#define IR_CODE_VOLUME_UP   0x807FC03F
+#define IR_CODE_VOLUME_DOWN 0x807F10EF
+#define IR_CODE_PREVIOUS    0x807FA05F
+#define IR_CODE_NEXT        0x807F609F
+#define IR_CODE_PLAY_PAUSE  0x807FE01F
+#define IR_CODE_TREBLE_UP   0x807FA45B
+#define IR_CODE_TREBLE_DOWN 0x807FE41B
+#define IR_CODE_BASS_UP     0x807F20DF
+#define IR_CODE_BASS_DOWN   0x807F649B
+#define IR_CODE_PAIR        0x807F906F
+#define IR_CODE_FLAT        0x807F48B7
+#define IR_CODE_MUSIC       0x807F946B
+#define IR_CODE_DIALOG      0x807F54AB
+#define IR_CODE_MOVIE       0x807F14EB
+// Pushed by nec_receive for a repeat frame, never a valid NEC code as the address and command fail their inverse checks
+#define IR_CODE_REPEAT      0xFFFFFFFF
+
+typedef struct IR_CODE_T_ {
+    const char *name;
+    uint32_t code;
+    bool input_change;  // Code is expected to change the state of the RGB LED
+} IR_CODE_T;
+
+#ifdef IR_BENCH
+// Cycles spent in the transmit path, only accumulated in the snowdon_ir_bench build
+typedef struct IR_BENCH_T_ {
+    uint32_t irq_cycles;        // Frame IRQ, including the DMA kick it makes
+    uint32_t kick_cycles;       // DMA kicks, from both the frame IRQ and ir_transmit()
+    uint32_t transmit_cycles;   // Queueing in ir_transmit(), including the DMA kick it makes
+    uint32_t rx_cycles;         // Receive IRQ, which also decodes every transmitted frame when the IR line is shared
+} IR_BENCH_T;
+extern volatile IR_BENCH_T ir_bench;
+#endif
+
+/*!
+  * \brief Load the NEC programs into PIO and start the transmit and receive state machines
+  */
+void ir_init(void);
+
+/*!
+  * \brief Look up a NEC code by its user facing name
+  * \param name User provided string
+  * \return Matching code entry, or NULL if the name is not recognised
+  */
+const IR_CODE_T* ir_code_from_name(const char *name);
+
+/*!
+  * \brief Look up the user facing name of a NEC code
+  * \param code NEC infrared code
+  * \return Matching code entry, or NULL if the code is not recognised
+  */
+const IR_CODE_T* ir_code_from_value(uint32_t code);
+
+/*!
+  * \brief Number of frames that can be queued before the transmit queue is full
+  */
+uint ir_transmit_free(void);
+
+/*!
+  * \brief Queue frames for transmission by DMA without touching the state model. Never blocks, either every code
+  *        is queued or none are
+  * \param codes NEC infrared codes to transmit in order
+  * \param count Number of codes
+  * \return Sequence number of the last queued frame, or 0 if the transmit queue does not have room for every code
+  */
+uint32_t ir_transmit(const uint32_t *codes, uint count);
+
+/*!
+  * \brief Fire a sequence of NEC codes on the devices IR line. Each code is applied to the state model by
+  *        ir_transmit_poll() once its frame has left the line. Must be called with the lwIP lock held
+  * \param codes NEC infrared codes to fire in order
+  * \param count Number of codes
+  * \return Sequence number of the last queued frame, or 0 if the transmit queue does not have room for every code
+  */
+uint32_t ir_send_sequence(const uint32_t *codes, uint count);
+
+/*!
+  * \brief Fire a NEC code on the devices IR line, it is applied to the state model by ir_transmit_poll() once its
+  *        frame has left the line. Must be called with the lwIP lock held
+  * \param code NEC infrared code
+  * \return Sequence number of the queued frame, or 0 if the transmit queue is full
+  */
+uint32_t ir_send(uint32_t code);
+
+/*!
+  * \brief Number of frames that have finished on the IR line since boot
+  */
+uint32_t ir_frames_done(void);
+
+/*!
+  * \brief Check whether a queued frame has finished on the IR line, without blocking
+  * \param seq Sequence number returned when the frame was queued
+  * \param done_us Set to the time the frame finished, in microseconds since boot. May be NULL
+  * \return true Frame has finished
+  * \return false Frame is still queued or being sent
+  */
+bool ir_frame_done(uint32_t seq, uint64_t *done_us);
+
+/*!
+  * \brief Apply frames fired by ir_send_sequence() that have finished since the last call to the state model,
+  *        timestamped with the time each left the IR line. Must be called with the lwIP lock held
+  * \return Number of frames applied
+  */
+uint ir_transmit_poll(void);
+
+/*!
+  * \brief Apply frames decoded from the IR line since the last call to the state model, repeat frames re-apply
+  *        the last decoded code. Must be called with the lwIP lock held
+  * \return Number of frames applied
+  */
+uint ir_receive_poll(void);
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+#include "snowdon.h"
+#include "ir.h"
+
+// Measures host CPU cycles spent per transmitted frame. The DMA path is timed with SysTick at entry and exit of the
+// frame IRQ, the DMA kick and ir_transmit(). The blocking path used before DMA, pio_sm_put_blocking() per code, is
+// timed the same way around each put as a baseline. Both include the receive IRQ, which decodes the echo of every
+// frame on a shared IR line. Frames are queued with ir_transmit() so are never applied to the state model, leaving
+// out ir_transmit_poll() and state_apply(), which the firmware runs from its main loop for each frame it fires
+
+#define IR_BENCH_FRAMES 24
+// NEC address not used by the soundbar, so running the benchmark does not change its state
+#define IR_BENCH_CODE 0x00FF00FF
+
+static uint32_t ir_bench_codes[IR_BENCH_FRAMES];
+
+/*!
+  * \brief Run SysTick from the system clock, free running over its full 24-bit range
+  */
+static void ir_bench_systick_init(void) {
+    systick_hw->csr = 0;
+    systick_hw->rvr = 0x00FFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+}
+
+/*!
+  * \brief Transmit a burst of frames fed by DMA, reporting cycles spent in the transmit path per frame
+  */
+static void ir_bench_dma(void) {
+    ir_bench.irq_cycles = 0;
+    ir_bench.kick_cycles = 0;
+    ir_bench.transmit_cycles = 0;
+    ir_bench.rx_cycles = 0;
+
+    uint32_t frames = ir_transmit(ir_bench_codes, IR_BENCH_FRAMES);
+    while ((int32_t)(ir_frames_done() - frames) < 0) { tight_loop_contents(); }
+    // Let the echo of the last frame be decoded before reading the counters
+    sleep_us(IR_FRAME_US);
+
+    // DMA kicks are made from within the frame IRQ and ir_transmit(), so are not added to the total
+    printf("dma:      irq %lu + rx irq %lu + ir_transmit %lu = %lu cycles/frame (dma kick %lu, excludes ir_transmit_poll)\n",
+           ir_bench.irq_cycles / IR_BENCH_FRAMES, ir_bench.rx_cycles / IR_BENCH_FRAMES,
+           ir_bench.transmit_cycles / IR_BENCH_FRAMES,
+           (ir_bench.irq_cycles + ir_bench.rx_cycles + ir_bench.transmit_cycles) / IR_BENCH_FRAMES,
+           ir_bench.kick_cycles / IR_BENCH_FRAMES);
+}
+
+/*!
+  * \brief Acknowledge a finished frame in place of the frame IRQ, releasing the nec program to start the next
+  * \return Number of frames acknowledged, 0 or 1
+  */
+static uint ir_bench_acknowledge(void) {
+    if (!pio_interrupt_get(PIO_INSTANCE, IR_TX_SM)) { return 0; }
+    pio_interrupt_clear(PIO_INSTANCE, IR_TX_SM);
+    return 1;
+}
+
+/*!
+  * \brief Transmit a burst of frames by putting each code into the TX FIFO, reporting cycles spent blocked per frame.
+  *        A single put never waits for more than one frame, well within the SysTick range at the default clock
+  */
+static void ir_bench_blocking(void) {
+    // These frames bypass the transmit queue, so hold off the frame IRQ to stop it counting them as done. The nec
+    // program waits for each completion to be acknowledged, so this loop does that itself whilst blocked on the FIFO
+    irq_set_enabled(IR_TX_IRQ, false);
+    ir_bench.rx_cycles = 0;
+
+    uint64_t cycles = 0;
+    uint done = 0;
+    for (int i = 0; i < IR_BENCH_FRAMES; i++) {
+        uint32_t start = systick_hw->cvr;
+        while (pio_sm_is_tx_fifo_full(PIO_INSTANCE, IR_TX_SM)) { done += ir_bench_acknowledge(); }
+        pio_sm_put(PIO_INSTANCE, IR_TX_SM, IR_BENCH_CODE);
+        cycles += (start - systick_hw->cvr) & 0xFFFFFF;
+    }
+
+    // Wait for the last frame to leave the line before handing back to DMA
+    while (done < IR_BENCH_FRAMES) { done += ir_bench_acknowledge(); }
+    irq_clear(IR_TX_IRQ);
+    irq_set_enabled(IR_TX_IRQ, true);
+    sleep_us(IR_FRAME_US);
+
+    printf("blocking: pio_sm_put_blocking %llu + rx irq %lu = %llu cycles/frame\n",
+           cycles / IR_BENCH_FRAMES, ir_bench.rx_cycles / IR_BENCH_FRAMES,
+           (cycles + ir_bench.rx_cycles) / IR_BENCH_FRAMES);
+}
+
+int main() {
+    stdio_init_all();
+    ir_init();
+    ir_bench_systick_init();
+    for (int i = 0; i < IR_BENCH_FRAMES; i++) { ir_bench_codes[i] = IR_BENCH_CODE; }
+
+    while(1) {
+        sleep_ms(5000);
+        printf("----------------\n");
+        printf("%d frames at %lu Hz\n", IR_BENCH_FRAMES, clock_get_hz(clk_sys));
+        ir_bench_dma();
+        ir_bench_blocking();
+    }
+    return 0;
+}
\ No newline at end of file
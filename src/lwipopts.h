@@ -1,6 +1,7 @@
 #ifndef _LWIPOPTS_EXAMPLE_COMMONH_H
 #define _LWIPOPTS_EXAMPLE_COMMONH_H
 
+#include "snowdon.h"
 
 // Common settings used in most of the pico_w examples
 // (see https://www.nongnu.org/lwip/2_1_x/group__lwip__opts.html for details)
@@ -20,7 +21,11 @@
 #define MEM_LIBC_MALLOC             0
 #endif
 #define MEM_ALIGNMENT               4
-#define MEM_SIZE                    4000
+// tcp_write() copies each response into the lwIP heap, so grow it by one send buffer per extra pooled connection
+#define MEM_SIZE                    (4000 + (TCP_MAX_CONNECTIONS - 1) * BUF_SIZE)
+// One pcb per pooled connection plus as many again for connections we closed that linger in TIME_WAIT. The listener
+// comes from MEMP_NUM_TCP_PCB_LISTEN, and lwIP recycles the oldest TIME_WAIT pcb if the pool still runs dry
+#define MEMP_NUM_TCP_PCB            (2 * TCP_MAX_CONNECTIONS)
 #define MEMP_NUM_TCP_SEG            32
 #define MEMP_NUM_ARP_QUEUE          10
 #define PBUF_POOL_SIZE              24
@@ -52,6 +57,12 @@
 #define DHCP_DOES_ARP_CHECK         0
 #define LWIP_DHCP_DOES_ACD_CHECK    0
 
+// SNTP keeps the on-device scheduler's wall clock in sync, see epoch.c
+void epoch_set(uint32_t sec);
+#define SNTP_SERVER_DNS             1
+#define SNTP_SET_SYSTEM_TIME(sec)   epoch_set(sec)
+#define MEMP_NUM_SYS_TIMEOUT        (LWIP_NUM_SYS_TIMEOUT_INTERNAL + 1)
+
 #ifndef NDEBUG
 #define LWIP_DEBUG                  1
 #define LWIP_STATS                  1
@@ -0,0 +1,144 @@
+# Summarise static RAM usage per subsystem from a GNU ld map file.
+#
+# Usage: cmake -DMAP_FILE=<snowdon.elf.map> [-DREPORT_FILE=<out.txt>] [-DRAM_STATIC_BUDGET=<bytes>]
+#              [-DRAM_HEAP_MIN=<bytes>] [-DRAM_BUDGET_FATAL=ON|OFF] -P ram_report.cmake
+#
+# Every input section placed in SRAM (0x20000000 - 0x20041fff, main banks plus scratch X/Y) is attributed
+# to a subsystem based on the object it came from. Application sources are reported per translation unit
+# so the cost of each module (connection pool, lwIP heap/pools, driver buffers) is visible after each build.
+#
+# The build fails (or warns, with RAM_BUDGET_FATAL=OFF) if static RAM exceeds RAM_STATIC_BUDGET or leaves
+# less than RAM_HEAP_MIN bytes for the heap. The heap can only grow through main RAM, from __end__ up to the
+# end of the striped banks, so scratch X/Y is counted towards static usage but never towards the heap.
+
+if (NOT DEFINED MAP_FILE OR NOT EXISTS "${MAP_FILE}")
+    message(FATAL_ERROR "ram_report: MAP_FILE not found: ${MAP_FILE}")
+endif()
+
+set(RAM_TOTAL 270336) # 264KB
+set(RAM_MAIN_END 0x20040000) # Striped main banks end here, scratch X/Y follow
+set(RAM_MAIN_TOTAL 262144) # 256KB
+if (NOT DEFINED RAM_STATIC_BUDGET)
+    set(RAM_STATIC_BUDGET ${RAM_TOTAL})
+endif()
+if (NOT DEFINED RAM_HEAP_MIN)
+    set(RAM_HEAP_MIN 0)
+endif()
+if (NOT DEFINED RAM_BUDGET_FATAL)
+    set(RAM_BUDGET_FATAL ON)
+endif()
+
+file(READ "${MAP_FILE}" map)
+
+# The linker marks the end of static data in main RAM, where the heap starts
+set(heap_start "")
+if (map MATCHES "\n +0x([0-9a-f]+) +__end__ = ")
+    math(EXPR heap_start "0x${CMAKE_MATCH_1}")
+endif()
+
+# Only the memory map section carries placement information
+string(FIND "${map}" "Linker script and memory map" map_start)
+if (map_start GREATER -1)
+    string(SUBSTRING "${map}" ${map_start} -1 map)
+endif()
+
+# Strip characters that have meaning in CMake lists, then join input sections whose names were too long
+# to share a line with their address and size
+string(REPLACE ";" "" map "${map}")
+string(REPLACE "[" "" map "${map}")
+string(REPLACE "]" "" map "${map}")
+string(REGEX REPLACE "\n ([^ \n]+)\n +0x" "\n \\1 0x" map "${map}")
+string(REPLACE "\n" ";" lines "${map}")
+
+set(subsystems "")
+set(main_used 0)
+foreach(line IN LISTS lines)
+    if (NOT line MATCHES "^ ([^ ]+) +0x(200[0-3][0-9a-f][0-9a-f][0-9a-f][0-9a-f]|2004[01][0-9a-f][0-9a-f][0-9a-f]) +0x([0-9a-f]+) +(.+)$")
+        continue()
+    endif()
+    set(section "${CMAKE_MATCH_1}")
+    set(address_hex "${CMAKE_MATCH_2}")
+    set(size_hex "${CMAKE_MATCH_3}")
+    set(object "${CMAKE_MATCH_4}")
+    math(EXPR size "0x${size_hex}")
+    if (size EQUAL 0)
+        continue()
+    endif()
+    if (address_hex MATCHES "^200[0-3]")
+        math(EXPR main_used "${main_used} + ${size}")
+    endif()
+
+    if (section MATCHES "^\\.stack" OR section MATCHES "^\\.heap")
+        string(REGEX REPLACE "^\\.([a-z]+).*" "\\1" subsystem "${section}")
+    elseif (object MATCHES "CMakeFiles/[^/]+\\.dir/([^/]+)\\.(c|S)\\.obj$")
+        set(subsystem "app:${CMAKE_MATCH_1}.${CMAKE_MATCH_2}")
+    elseif (object MATCHES "lwip")
+        set(subsystem "lwip")
+    elseif (object MATCHES "cyw43")
+        set(subsystem "cyw43")
+    elseif (object MATCHES "lib(c|g|m|nosys|gcc)(_nano)?\\.a")
+        set(subsystem "libc")
+    elseif (object MATCHES "pico")
+        set(subsystem "pico-sdk")
+    else()
+        set(subsystem "other")
+    endif()
+
+    string(MAKE_C_IDENTIFIER "${subsystem}" key)
+    if (NOT DEFINED ram_${key})
+        set(ram_${key} 0)
+        list(APPEND subsystems "${subsystem}")
+    endif()
+    math(EXPR ram_${key} "${ram_${key}} + ${size}")
+endforeach()
+
+list(SORT subsystems)
+set(used 0)
+set(report "RAM usage by subsystem (bytes)\n")
+foreach(subsystem IN LISTS subsystems)
+    string(MAKE_C_IDENTIFIER "${subsystem}" key)
+    math(EXPR used "${used} + ${ram_${key}}")
+    string(LENGTH "${subsystem}" len)
+    math(EXPR pad "24 - ${len}")
+    if (pad LESS 1)
+        set(pad 1)
+    endif()
+    string(REPEAT " " ${pad} spaces)
+    string(APPEND report "  ${subsystem}${spaces}${ram_${key}}\n")
+endforeach()
+# Fall back to summing main RAM sections if the map has no __end__ symbol
+if (heap_start STREQUAL "")
+    math(EXPR free "${RAM_MAIN_TOTAL} - ${main_used}")
+else()
+    math(EXPR free "${RAM_MAIN_END} - ${heap_start}")
+endif()
+string(APPEND report "  ------------------------\n")
+string(APPEND report "  static total            ${used} of ${RAM_TOTAL}\n")
+string(APPEND report "  heap (main RAM)         ${free} of ${RAM_MAIN_TOTAL}\n")
+
+set(over_budget "")
+if (used GREATER RAM_STATIC_BUDGET)
+    string(APPEND over_budget "static RAM ${used} exceeds budget of ${RAM_STATIC_BUDGET} bytes. ")
+endif()
+if (free LESS RAM_HEAP_MIN)
+    string(APPEND over_budget "heap ${free} is below minimum of ${RAM_HEAP_MIN} bytes. ")
+endif()
+string(APPEND report "  budget                  static <= ${RAM_STATIC_BUDGET}, heap >= ${RAM_HEAP_MIN}")
+if (over_budget STREQUAL "")
+    string(APPEND report " ok\n")
+else()
+    string(APPEND report " EXCEEDED\n")
+endif()
+
+message("${report}")
+if (DEFINED REPORT_FILE)
+    file(WRITE "${REPORT_FILE}" "${report}")
+endif()
+
+if (NOT over_budget STREQUAL "")
+    if (RAM_BUDGET_FATAL)
+        message(FATAL_ERROR "ram_report: ${over_budget}")
+    else()
+        message(WARNING "ram_report: ${over_budget}")
+    endif()
+endif()
@@ -0,0 +1,467 @@
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "snowdon.h"
+#include "ir.h"
+#include "epoch.h"
+#include "scheduler.h"
+
+#define SCHEDULER_FLASH_MAGIC 0x4C484353  // "SCHL"
+
+// Starts each bank, programmed last when a bank is compacted so a bank is only valid once its snapshot is complete
+typedef struct SCHEDULER_FLASH_HEADER_T_ {
+    uint32_t magic;
+    uint32_t sequence;  // Incremented on each compaction, the valid bank with the highest sequence holds the log
+} SCHEDULER_FLASH_HEADER_T;
+
+// Log entry replacing a job, later records for the same id win on replay
+typedef struct SCHEDULER_FLASH_RECORD_T_ {
+    uint32_t fire_at;
+    uint32_t period_s;
+    uint32_t codes[SCHEDULER_MAX_CODES];
+    uint16_t id;
+    uint8_t code_count; // 0 when the job was deleted
+    uint8_t reserved;
+    uint32_t check;     // Catches records torn by a power cut whilst programming
+} SCHEDULER_FLASH_RECORD_T;
+
+// Jobs are persisted to two banks of sectors at the very end of flash, well clear of the program image. Changes are
+// appended to the log in one bank, and only once it is full are the live jobs compacted into the other. Each bank
+// holds a full snapshot plus as many records again, so a sector is erased at most once per SCHEDULER_MAX_JOBS changes
+#define SCHEDULER_FLASH_LOG_START sizeof(SCHEDULER_FLASH_RECORD_T)
+#define SCHEDULER_BANK_SIZE ((SCHEDULER_FLASH_LOG_START + 2 * SCHEDULER_MAX_JOBS * sizeof(SCHEDULER_FLASH_RECORD_T) \
+                              + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1))
+#define SCHEDULER_BANK_RECORDS ((SCHEDULER_BANK_SIZE - SCHEDULER_FLASH_LOG_START) / sizeof(SCHEDULER_FLASH_RECORD_T))
+#define SCHEDULER_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - 2 * SCHEDULER_BANK_SIZE)
+
+static_assert(sizeof(SCHEDULER_FLASH_HEADER_T) <= SCHEDULER_FLASH_LOG_START, "Header must fit before the log");
+static_assert(sizeof(SCHEDULER_FLASH_RECORD_T) == 32, "Records must not straddle flash pages");
+static_assert(SCHEDULER_MAX_JOBS < SCHEDULER_NO_JOB, "Job ids must fit the wheel links");
+
+static SCHEDULER_JOB_T scheduler_jobs[SCHEDULER_MAX_JOBS];
+static uint16_t scheduler_wheel[SCHEDULER_WHEEL_SLOTS];
+static uint32_t scheduler_time;  // Last second processed by the wheel, 0 before the first run
+static uint32_t scheduler_count;
+static uint32_t scheduler_dirty[(SCHEDULER_MAX_JOBS + 31) / 32];  // Jobs changed since they were last logged
+static uint32_t scheduler_dirty_count;
+static uint32_t scheduler_dirty_ms;
+
+static uint scheduler_bank;             // Bank holding the log
+static uint32_t scheduler_bank_sequence;
+static uint32_t scheduler_log_len;      // Bytes of the bank in use, 0 if neither bank holds a valid log
+static uint32_t scheduler_erased_end;   // Flash offset up to which the bank has been erased for the log to grow into
+
+static uint8_t scheduler_page[FLASH_PAGE_SIZE];
+static uint32_t scheduler_page_len;
+static uint32_t scheduler_flash_cursor;
+
+/*!
+  * \brief Push a job onto the head of the wheel slot its firing time hashes to
+  * \param id Job id
+  */
+static void scheduler_link(uint16_t id) {
+    SCHEDULER_JOB_T *job = &scheduler_jobs[id];
+    uint16_t *head = &scheduler_wheel[job->fire_at % SCHEDULER_WHEEL_SLOTS];
+    job->prev = SCHEDULER_NO_JOB;
+    job->next = *head;
+    if (*head != SCHEDULER_NO_JOB) { scheduler_jobs[*head].prev = id; }
+    *head = id;
+}
+
+/*!
+  * \brief Remove a job from its wheel slot
+  * \param id Job id
+  */
+static void scheduler_unlink(uint16_t id) {
+    SCHEDULER_JOB_T *job = &scheduler_jobs[id];
+    if (job->prev != SCHEDULER_NO_JOB) {
+        scheduler_jobs[job->prev].next = job->next;
+    } else {
+        scheduler_wheel[job->fire_at % SCHEDULER_WHEEL_SLOTS] = job->next;
+    }
+    if (job->next != SCHEDULER_NO_JOB) { scheduler_jobs[job->next].prev = job->prev; }
+}
+
+/*!
+  * \brief Flag a job as changed, deferring the flash write until changes settle
+  * \param id Job id
+  */
+static void scheduler_mark_dirty(uint16_t id) {
+    if (!(scheduler_dirty[id / 32] & (1u << (id % 32)))) {
+        scheduler_dirty[id / 32] |= 1u << (id % 32);
+        scheduler_dirty_count++;
+    }
+    scheduler_dirty_ms = to_ms_since_boot(get_absolute_time());
+}
+
+/*!
+  * \brief Fire a due job on the IR line, then re-arm it if recurring or free it if one-shot
+  * \param id Job id
+  * \param now Seconds since the unix epoch
+  * \return true Job was fired or skipped
+  * \return false IR transmit queue cannot take the whole job yet, the job is left untouched
+  */
+static bool scheduler_fire(uint16_t id, uint32_t now) {
+    SCHEDULER_JOB_T *job = &scheduler_jobs[id];
+    // Skip rather than replay jobs that were missed by more than the grace period, e.g. whilst powered off
+    bool on_time = now - job->fire_at <= SCHEDULER_GRACE_S;
+    if (on_time && ir_transmit_free() < job->code_count) { return false; }
+    scheduler_unlink(id);
+
+    if (on_time) {
+        DEBUG_printf("scheduler_fire job %u\n", id);
+        ir_send_sequence(job->codes, job->code_count);
+    } else {
+        DEBUG_printf("scheduler_fire job %u missed by %lus, skipping\n", id, now - job->fire_at);
+    }
+
+    if (job->period_s == 0) {
+        job->code_count = 0;
+        scheduler_count--;
+        scheduler_mark_dirty(id);
+        return true;
+    }
+    // Recurring jobs are not persisted on each firing, the next firing is recomputed from the period after a reboot
+    uint32_t fire_at = job->fire_at + ((now - job->fire_at) / job->period_s + 1) * job->period_s;
+    // Daily and weekly jobs keep to the same local wall clock time across summer time changes
+    if (job->period_s % SCHEDULER_DAY_S == 0) {
+        int32_t shift = epoch_utc_offset(job->fire_at) - epoch_utc_offset(fire_at);
+        fire_at += shift;
+        if (fire_at <= now) { fire_at += job->period_s; }
+    }
+    job->fire_at = fire_at;
+    scheduler_link(id);
+    return true;
+}
+
+/*!
+  * \brief Fire every overdue job once, used when the wheel cannot simply be stepped (first sync, clock step or stall).
+  *        If the IR transmit queue fills, the wheel time is left alone so the scan resumes on the next run
+  * \param now Seconds since the unix epoch
+  */
+static void scheduler_resync(uint32_t now) {
+    DEBUG_printf("scheduler_resync %lu -> %lu\n", scheduler_time, now);
+    for (uint16_t id = 0; id < SCHEDULER_MAX_JOBS; id++) {
+        if (scheduler_jobs[id].code_count == 0) { continue; }
+        if (scheduler_jobs[id].fire_at <= now && !scheduler_fire(id, now)) { return; }
+    }
+    scheduler_time = now;
+}
+
+/*!
+  * \brief Process a single wheel slot, firing jobs whose time has come and leaving jobs due on later revolutions
+  * \param now Seconds since the unix epoch
+  * \return true Every due job in the slot was processed
+  * \return false IR transmit queue is full, the remaining jobs are still linked into the slot
+  */
+static bool scheduler_tick(uint32_t now) {
+    uint16_t id = scheduler_wheel[now % SCHEDULER_WHEEL_SLOTS];
+    while (id != SCHEDULER_NO_JOB) {
+        uint16_t next = scheduler_jobs[id].next;
+        if (scheduler_jobs[id].fire_at <= now && !scheduler_fire(id, now)) { return false; }
+        id = next;
+    }
+    return true;
+}
+
+/*!
+  * \brief Flash offset of a bank
+  * \param bank Bank number, 0 or 1
+  */
+static uint32_t scheduler_bank_offset(uint bank) {
+    return SCHEDULER_FLASH_OFFSET + bank * SCHEDULER_BANK_SIZE;
+}
+
+/*!
+  * \brief Checksum a record, FNV-1a over every field but the check itself
+  * \param record Record to check
+  */
+static uint32_t scheduler_flash_check(const SCHEDULER_FLASH_RECORD_T *record) {
+    const uint8_t *bytes = (const uint8_t*)record;
+    uint32_t hash = 0x811C9DC5;
+    for (uint32_t i = 0; i < offsetof(SCHEDULER_FLASH_RECORD_T, check); i++) {
+        hash = (hash ^ bytes[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+/*!
+  * \brief Check whether a record slot has never been programmed since its sector was erased
+  * \param record Record slot in flash
+  */
+static bool scheduler_flash_erased(const SCHEDULER_FLASH_RECORD_T *record) {
+    const uint32_t *words = (const uint32_t*)record;
+    for (uint32_t i = 0; i < sizeof(*record) / sizeof(uint32_t); i++) {
+        if (words[i] != 0xFFFFFFFF) { return false; }
+    }
+    return true;
+}
+
+/*!
+  * \brief Erase the bank up to an offset, a sector at a time so interrupts are not held off for long
+  * \param end Flash offset that must be erased up to
+  */
+static void scheduler_flash_erase_to(uint32_t end) {
+    while (scheduler_erased_end < end) {
+        uint32_t ints = save_and_disable_interrupts();
+        flash_range_erase(scheduler_erased_end, FLASH_SECTOR_SIZE);
+        restore_interrupts(ints);
+        scheduler_erased_end += FLASH_SECTOR_SIZE;
+    }
+}
+
+/*!
+  * \brief Program the buffered page to flash. Bytes not written since the page was started are left erased, so
+  *        programming them again does not disturb what is already in flash
+  */
+static void scheduler_flash_flush(void) {
+    scheduler_flash_erase_to(scheduler_flash_cursor + FLASH_PAGE_SIZE);
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_program(scheduler_flash_cursor, scheduler_page, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+    scheduler_flash_cursor += FLASH_PAGE_SIZE;
+    scheduler_page_len = 0;
+    memset(scheduler_page, 0xFF, FLASH_PAGE_SIZE);
+}
+
+/*!
+  * \brief Start buffering bytes destined for flash
+  * \param offset Flash offset of the first byte, need not be page aligned
+  */
+static void scheduler_flash_begin(uint32_t offset) {
+    scheduler_flash_cursor = offset & ~(FLASH_PAGE_SIZE - 1);
+    scheduler_page_len = offset - scheduler_flash_cursor;
+    memset(scheduler_page, 0xFF, FLASH_PAGE_SIZE);
+}
+
+/*!
+  * \brief Buffer bytes destined for flash, programming a page each time the buffer fills
+  * \param data Bytes to write
+  * \param len Number of bytes
+  */
+static void scheduler_flash_emit(const void *data, uint32_t len) {
+    const uint8_t *bytes = (const uint8_t*)data;
+    while (len) {
+        uint32_t chunk = MIN(len, FLASH_PAGE_SIZE - scheduler_page_len);
+        memcpy(scheduler_page + scheduler_page_len, bytes, chunk);
+        scheduler_page_len += chunk;
+        bytes += chunk;
+        len -= chunk;
+        if (scheduler_page_len == FLASH_PAGE_SIZE) { scheduler_flash_flush(); }
+    }
+}
+
+/*!
+  * \brief Buffer a record of a job's current state, a free slot is recorded as a deletion
+  * \param id Job id
+  */
+static void scheduler_flash_emit_job(uint16_t id) {
+    SCHEDULER_JOB_T *job = &scheduler_jobs[id];
+    SCHEDULER_FLASH_RECORD_T record = {job->fire_at, job->period_s, {0}, id, job->code_count, 0, 0};
+    if (job->code_count != 0) { memcpy(record.codes, job->codes, sizeof(record.codes)); }
+    record.check = scheduler_flash_check(&record);
+    scheduler_flash_emit(&record, sizeof(record));
+    scheduler_log_len += sizeof(record);
+}
+
+/*!
+  * \brief Append a record for each changed job to the log
+  */
+static void scheduler_flash_append(void) {
+    DEBUG_printf("scheduler_flash_append %lu jobs\n", scheduler_dirty_count);
+    scheduler_flash_begin(scheduler_bank_offset(scheduler_bank) + scheduler_log_len);
+    for (uint16_t id = 0; id < SCHEDULER_MAX_JOBS; id++) {
+        if (scheduler_dirty[id / 32] & (1u << (id % 32))) { scheduler_flash_emit_job(id); }
+    }
+    if (scheduler_page_len) { scheduler_flash_flush(); }
+}
+
+/*!
+  * \brief Write a snapshot of every job to the other bank, then its header to make it the bank holding the log.
+  *        The old bank stays valid until the header is programmed, so a power cut part way loses nothing
+  */
+static void scheduler_flash_compact(void) {
+    uint bank = scheduler_bank ^ 1;
+    DEBUG_printf("scheduler_flash_compact %lu jobs into bank %u\n", scheduler_count, bank);
+
+    scheduler_erased_end = scheduler_bank_offset(bank);
+    scheduler_log_len = SCHEDULER_FLASH_LOG_START;
+    scheduler_flash_begin(scheduler_bank_offset(bank) + SCHEDULER_FLASH_LOG_START);
+    for (uint16_t id = 0; id < SCHEDULER_MAX_JOBS; id++) {
+        if (scheduler_jobs[id].code_count != 0) { scheduler_flash_emit_job(id); }
+    }
+    if (scheduler_page_len) { scheduler_flash_flush(); }
+
+    SCHEDULER_FLASH_HEADER_T header = {SCHEDULER_FLASH_MAGIC, scheduler_bank_sequence + 1};
+    scheduler_flash_begin(scheduler_bank_offset(bank));
+    scheduler_flash_emit(&header, sizeof(header));
+    scheduler_flash_flush();
+    scheduler_bank = bank;
+    scheduler_bank_sequence = header.sequence;
+}
+
+/*!
+  * \brief Find the bank holding the log and replay it into the job table
+  */
+static void scheduler_flash_read(void) {
+    scheduler_bank = 1;
+    scheduler_bank_sequence = 0;
+    scheduler_log_len = 0;
+    for (uint bank = 0; bank < 2; bank++) {
+        const SCHEDULER_FLASH_HEADER_T *header = (const SCHEDULER_FLASH_HEADER_T*)(XIP_BASE + scheduler_bank_offset(bank));
+        if (header->magic != SCHEDULER_FLASH_MAGIC) { continue; }
+        if (scheduler_log_len == 0 || (int32_t)(header->sequence - scheduler_bank_sequence) > 0) {
+            scheduler_bank = bank;
+            scheduler_bank_sequence = header->sequence;
+            scheduler_log_len = SCHEDULER_FLASH_LOG_START;
+        }
+    }
+    if (scheduler_log_len == 0) { return; }
+
+    // The log ends at the first slot never programmed, a torn record still takes up its slot but is not replayed
+    const SCHEDULER_FLASH_RECORD_T *records =
+        (const SCHEDULER_FLASH_RECORD_T*)(XIP_BASE + scheduler_bank_offset(scheduler_bank) + SCHEDULER_FLASH_LOG_START);
+    for (uint32_t i = 0; i < SCHEDULER_BANK_RECORDS && !scheduler_flash_erased(&records[i]); i++) {
+        const SCHEDULER_FLASH_RECORD_T *record = &records[i];
+        scheduler_log_len += sizeof(*record);
+        if (record->check != scheduler_flash_check(record)) { continue; }
+        if (record->id >= SCHEDULER_MAX_JOBS || record->code_count > SCHEDULER_MAX_CODES) { continue; }
+        SCHEDULER_JOB_T *job = &scheduler_jobs[record->id];
+        job->fire_at = record->fire_at;
+        job->period_s = record->period_s;
+        job->code_count = record->code_count;
+        memcpy(job->codes, record->codes, sizeof(job->codes));
+    }
+    // Sectors past the end of the log may hold an older log, they are erased as the log grows into them
+    scheduler_erased_end = scheduler_bank_offset(scheduler_bank)
+                           + ((scheduler_log_len + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1));
+}
+
+/*!
+  * \brief Restore jobs persisted to flash and link them into the timer wheel
+  */
+void scheduler_init(void) {
+    memset(scheduler_wheel, 0xFF, sizeof(scheduler_wheel));
+    memset(scheduler_jobs, 0, sizeof(scheduler_jobs));
+    memset(scheduler_dirty, 0, sizeof(scheduler_dirty));
+    scheduler_time = 0;
+    scheduler_count = 0;
+    scheduler_dirty_count = 0;
+
+    scheduler_flash_read();
+    if (scheduler_log_len == 0) {
+        DEBUG_printf("scheduler_init no jobs in flash\n");
+        return;
+    }
+    for (uint16_t id = 0; id < SCHEDULER_MAX_JOBS; id++) {
+        if (scheduler_jobs[id].code_count == 0) { continue; }
+        scheduler_link(id);
+        scheduler_count++;
+    }
+    DEBUG_printf("scheduler_init restored %lu jobs from bank %u\n", scheduler_count, scheduler_bank);
+}
+
+/*!
+  * \brief Store a new job
+  * \param fire_at Seconds since the unix epoch of the first firing
+  * \param period_s Seconds between firings, 0 for a one-shot job
+  * \param codes NEC infrared codes to fire in order
+  * \param code_count Number of codes, between 1 and SCHEDULER_MAX_CODES
+  * \return Job id, or -1 if the job is invalid or the scheduler is full
+  */
+int scheduler_add(uint32_t fire_at, uint32_t period_s, const uint32_t *codes, uint8_t code_count) {
+    if (fire_at == 0 || code_count == 0 || code_count > SCHEDULER_MAX_CODES) { return -1; }
+    if (scheduler_count >= SCHEDULER_MAX_JOBS) { return -1; }
+
+    uint16_t id = 0;
+    while (scheduler_jobs[id].code_count != 0) { id++; }
+
+    // The wheel will not revisit a slot it has already passed for a full revolution, so pull the job forward
+    if (scheduler_time != 0 && fire_at <= scheduler_time) { fire_at = scheduler_time + 1; }
+
+    SCHEDULER_JOB_T *job = &scheduler_jobs[id];
+    job->fire_at = fire_at;
+    job->period_s = period_s;
+    job->code_count = code_count;
+    memset(job->codes, 0, sizeof(job->codes));
+    memcpy(job->codes, codes, code_count * sizeof(uint32_t));
+    scheduler_link(id);
+    scheduler_count++;
+    scheduler_mark_dirty(id);
+    return id;
+}
+
+/*!
+  * \brief Delete a job
+  * \param id Job id
+  * \return true Job was deleted
+  * \return false No job exists with this id
+  */
+bool scheduler_remove(uint32_t id) {
+    if (scheduler_get(id) == NULL) { return false; }
+    scheduler_unlink(id);
+    scheduler_jobs[id].code_count = 0;
+    scheduler_count--;
+    scheduler_mark_dirty(id);
+    return true;
+}
+
+/*!
+  * \brief Get a job by id
+  * \param id Job id
+  * \return Pointer to job, or NULL if no job exists with this id
+  */
+const SCHEDULER_JOB_T* scheduler_get(uint32_t id) {
+    if (id >= SCHEDULER_MAX_JOBS || scheduler_jobs[id].code_count == 0) { return NULL; }
+    return &scheduler_jobs[id];
+}
+
+/*!
+  * \brief Find the first job at or after an id, for iterating over all jobs
+  * \param id Job id to start searching from
+  * \return Job id, or -1 if there are no further jobs
+  */
+int scheduler_next(uint32_t id) {
+    for (; id < SCHEDULER_MAX_JOBS; id++) {
+        if (scheduler_jobs[id].code_count != 0) { return id; }
+    }
+    return -1;
+}
+
+/*!
+  * \brief Advance the timer wheel to the current time, firing any jobs that fall due.
+  *        Must be called with the lwIP lock held
+  * \param now Seconds since the unix epoch
+  */
+void scheduler_run(uint32_t now) {
+    if (now == 0 || now == scheduler_time) { return; }
+
+    // Step the wheel one second at a time, only falling back to a full scan if too much time has passed
+    if (scheduler_time == 0 || now < scheduler_time || now - scheduler_time > SCHEDULER_WHEEL_SLOTS) {
+        scheduler_resync(now);
+        return;
+    }
+    // Hold the wheel on a second whose jobs do not fit in the IR transmit queue, they are retried as frames drain
+    while (scheduler_time != now) {
+        if (!scheduler_tick(scheduler_time + 1)) { return; }
+        scheduler_time++;
+    }
+}
+
+/*!
+  * \brief Write jobs to flash if they have changed and settled. Must be called with the lwIP lock held
+  */
+void scheduler_persist(void) {
+    if (scheduler_dirty_count == 0) { return; }
+    if (to_ms_since_boot(get_absolute_time()) - scheduler_dirty_ms < SCHEDULER_PERSIST_DELAY_MS) { return; }
+    if (scheduler_log_len == 0 || scheduler_log_len + scheduler_dirty_count * sizeof(SCHEDULER_FLASH_RECORD_T) > SCHEDULER_BANK_SIZE) {
+        scheduler_flash_compact();
+    } else {
+        scheduler_flash_append();
+    }
+    memset(scheduler_dirty, 0, sizeof(scheduler_dirty));
+    scheduler_dirty_count = 0;
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+#include "pico/stdlib.h"
+
+// Each job costs 32 bytes of RAM and 128 bytes of flash across the two log banks, so the job table is capped at a
+// thousand or so jobs to stay within the static RAM budget. Raise SCHEDULER_WHEEL_SLOTS alongside it
+#define SCHEDULER_MAX_JOBS 1024
+#define SCHEDULER_MAX_CODES 4
+// One slot per second, sized to the job count so a tick visits one job on average
+#define SCHEDULER_WHEEL_SLOTS 1024
+#define SCHEDULER_GRACE_S 60
+#define SCHEDULER_PERSIST_DELAY_MS 5000
+#define SCHEDULER_POLL_MS 50
+#define SCHEDULER_NO_JOB 0xFFFF
+// Jobs recurring on a multiple of this period follow local time, see epoch_utc_offset()
+#define SCHEDULER_DAY_S 86400
+
+typedef struct SCHEDULER_JOB_T_ {
+    uint32_t fire_at;   // Seconds since the unix epoch of the next firing
+    uint32_t period_s;  // Seconds between firings, 0 for a one-shot job
+    uint32_t codes[SCHEDULER_MAX_CODES];
+    uint16_t next;      // Wheel slot list links
+    uint16_t prev;
+    uint8_t code_count; // 0 when the job slot is free
+} SCHEDULER_JOB_T;
+
+/*!
+  * \brief Restore jobs persisted to flash and link them into the timer wheel
+  */
+void scheduler_init(void);
+
+/*!
+  * \brief Store a new job
+  * \param fire_at Seconds since the unix epoch of the first firing
+  * \param period_s Seconds between firings, 0 for a one-shot job
+  * \param codes NEC infrared codes to fire in order
+  * \param code_count Number of codes, between 1 and SCHEDULER_MAX_CODES
+  * \return Job id, or -1 if the job is invalid or the scheduler is full
+  */
+int scheduler_add(uint32_t fire_at, uint32_t period_s, const uint32_t *codes, uint8_t code_count);
+
+/*!
+  * \brief Delete a job
+  * \param id Job id
+  * \return true Job was deleted
+  * \return false No job exists with this id
+  */
+bool scheduler_remove(uint32_t id);
+
+/*!
+  * \brief Get a job by id
+  * \param id Job id
+  * \return Pointer to job, or NULL if no job exists with this id
+  */
+const SCHEDULER_JOB_T* scheduler_get(uint32_t id);
+
+/*!
+  * \brief Find the first job at or after an id, for iterating over all jobs
+  * \param id Job id to start searching from
+  * \return Job id, or -1 if there are no further jobs
+  */
+int scheduler_next(uint32_t id);
+
+/*!
+  * \brief Advance the timer wheel to the current time, firing any jobs that fall due.
+  *        Must be called with the lwIP lock held
+  * \param now Seconds since the unix epoch
+  */
+void scheduler_run(uint32_t now);
+
+/*!
+  * \brief Write jobs to flash if they have changed and settled. Must be called with the lwIP lock held
+  */
+void scheduler_persist(void);
\ No newline at end of file
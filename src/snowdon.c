@@ -1,9 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "pico/stdlib.h"
-#include "hardware/pio.h"
-#include "nec.pio.h"
 #include "snowdon.h"
+#include "ir.h"
+#include "scheduler.h"
 #include "tcp.h"
 
 const uint32_t RGB_MASK = 1 << 17 | 1 << 18 | 1 << 19;
@@ -13,8 +13,8 @@ int main() {
 
     gpio_init_mask(RGB_MASK);
 
-    uint nec_offset = pio_add_program(PIO_INSTANCE, &nec_program);
-    nec_program_init(PIO_INSTANCE, 0 , nec_offset, IR_PIN);
+    ir_init();
+    scheduler_init();
     run_tcp_server();
     return 0;
 }
\ No newline at end of file
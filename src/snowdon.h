@@ -1,8 +1,23 @@
+#pragma once
+#include <stdint.h>
+
 #define TCP_PORT 8080
 #define DEBUG_printf printf
 #define BUF_SIZE 2048
 #define POLL_TIME_S 5
+#define TCP_MAX_CONNECTIONS 4
+// /events long-polls hold their slot until the next event, always leave one slot free for ordinary requests
+#define TCP_MAX_EVENT_WAITERS (TCP_MAX_CONNECTIONS - 1)
+#define WIFI_CHECK_MS 10000
+#define WIFI_CONNECT_TIMEOUT_MS 30000
+#define SNTP_SERVER "pool.ntp.org"
+// Local time zone for daily / weekly scheduled jobs, standard offset from UTC and whether EU summer time rules apply
+#define TZ_OFFSET_S 0
+#define TZ_EU_DST 1
 #define IR_PIN 16
+// Line sampled for frames from the physical remote. The nec program drives IR_PIN open drain, so whilst idle the IR line
+// carries the receiver output and can be sampled directly. May instead be a separate GPIO tapped onto the receiver output
+#define IR_RX_PIN IR_PIN
 #define PIO_INSTANCE pio0
 #define RGB_BASE_PIN 17
 extern const uint32_t RGB_MASK;
\ No newline at end of file
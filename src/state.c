@@ -0,0 +1,86 @@
+#include "pico/stdlib.h"
+#include "snowdon.h"
+#include "ir.h"
+#include "state.h"
+
+static int32_t state_volume_steps;
+static STATE_EQ_T state_eq_mode = STATE_EQ_UNKNOWN;
+
+// Ring of the most recent events, indexed by sequence number
+static STATE_EVENT_T state_events[STATE_EVENT_QUEUE];
+static uint32_t state_seq;
+
+/*!
+  * \brief Update the cached soundbar state with a NEC code seen on the IR line and record it as an event.
+  *        Must be called with the lwIP lock held
+  * \param code NEC infrared code
+  * \param timestamp_us Time the code was sent or decoded, in microseconds since boot
+  * \param source Whether the code was fired by this firmware or decoded from the IR line
+  */
+void state_apply(uint32_t code, uint64_t timestamp_us, STATE_SOURCE_T source) {
+    switch (code) {
+        case IR_CODE_VOLUME_UP:     state_volume_steps++; break;
+        case IR_CODE_VOLUME_DOWN:   state_volume_steps--; break;
+        case IR_CODE_FLAT:          state_eq_mode = STATE_EQ_FLAT; break;
+        case IR_CODE_MUSIC:         state_eq_mode = STATE_EQ_MUSIC; break;
+        case IR_CODE_DIALOG:        state_eq_mode = STATE_EQ_DIALOG; break;
+        case IR_CODE_MOVIE:         state_eq_mode = STATE_EQ_MOVIE; break;
+    }
+
+    state_seq++;
+    STATE_EVENT_T *event = &state_events[state_seq % STATE_EVENT_QUEUE];
+    event->seq = state_seq;
+    event->code = code;
+    event->timestamp_us = timestamp_us;
+    event->source = source;
+    DEBUG_printf("state_apply %#lx from %s, volume %ld\n", code, source == STATE_SOURCE_REMOTE ? "remote" : "device", 
+                 state_volume_steps);
+}
+
+/*!
+  * \brief Estimated volume relative to boot, in remote button presses
+  */
+int32_t state_volume(void) {
+    return state_volume_steps;
+}
+
+/*!
+  * \brief Current EQ mode, STATE_EQ_UNKNOWN until an EQ code has been seen
+  */
+STATE_EQ_T state_eq(void) {
+    return state_eq_mode;
+}
+
+/*!
+  * \brief User facing name of an EQ mode
+  * \param eq EQ mode
+  * \return EQ mode name
+  */
+const char* state_eq_name(STATE_EQ_T eq) {
+    switch (eq) {
+        case STATE_EQ_FLAT:     return "flat";
+        case STATE_EQ_MUSIC:    return "music";
+        case STATE_EQ_DIALOG:   return "dialog";
+        case STATE_EQ_MOVIE:    return "movie";
+        default:                return "unknown";
+    }
+}
+
+/*!
+  * \brief Sequence number of the most recent event, 0 if no events have occurred
+  */
+uint32_t state_event_seq(void) {
+    return state_seq;
+}
+
+/*!
+  * \brief Find the oldest retained event newer than a sequence number, for iterating over events
+  * \param seq Sequence number of the last event seen
+  * \return Pointer to event, or NULL if there are no newer events
+  */
+const STATE_EVENT_T* state_event_after(uint32_t seq) {
+    if (seq >= state_seq) { return NULL; }
+    // Events older than the ring have been overwritten, skip ahead to the oldest one still held
+    if (state_seq - seq > STATE_EVENT_QUEUE) { seq = state_seq - STATE_EVENT_QUEUE; }
+    return &state_events[(seq + 1) % STATE_EVENT_QUEUE];
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+#include "pico/stdlib.h"
+
+#define STATE_EVENT_QUEUE 16
+
+typedef enum STATE_EQ_T_ {
+    STATE_EQ_UNKNOWN,
+    STATE_EQ_FLAT,
+    STATE_EQ_MUSIC,
+    STATE_EQ_DIALOG,
+    STATE_EQ_MOVIE
+} STATE_EQ_T;
+
+typedef enum STATE_SOURCE_T_ {
+    STATE_SOURCE_DEVICE,    // Code was fired by this firmware
+    STATE_SOURCE_REMOTE     // Code was decoded from the IR line, e.g. the physical remote
+} STATE_SOURCE_T;
+
+typedef struct STATE_EVENT_T_ {
+    uint32_t seq;
+    uint32_t code;
+    uint64_t timestamp_us;
+    STATE_SOURCE_T source;
+} STATE_EVENT_T;
+
+/*!
+  * \brief Update the cached soundbar state with a NEC code seen on the IR line and record it as an event.
+  *        Must be called with the lwIP lock held
+  * \param code NEC infrared code
+  * \param timestamp_us Time the code was sent or decoded, in microseconds since boot
+  * \param source Whether the code was fired by this firmware or decoded from the IR line
+  */
+void state_apply(uint32_t code, uint64_t timestamp_us, STATE_SOURCE_T source);
+
+/*!
+  * \brief Estimated volume relative to boot, in remote button presses
+  */
+int32_t state_volume(void);
+
+/*!
+  * \brief Current EQ mode, STATE_EQ_UNKNOWN until an EQ code has been seen
+  */
+STATE_EQ_T state_eq(void);
+
+/*!
+  * \brief User facing name of an EQ mode
+  * \param eq EQ mode
+  * \return EQ mode name
+  */
+const char* state_eq_name(STATE_EQ_T eq);
+
+/*!
+  * \brief Sequence number of the most recent event, 0 if no events have occurred
+  */
+uint32_t state_event_seq(void);
+
+/*!
+  * \brief Find the oldest retained event newer than a sequence number, for iterating over events
+  * \param seq Sequence number of the last event seen
+  * \return Pointer to event, or NULL if there are no newer events
+  */
+const STATE_EVENT_T* state_event_after(uint32_t seq);
\ No newline at end of file
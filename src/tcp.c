@@ -1,3 +1,4 @@
+#include <string.h>
 #include "pico/cyw43_arch.h"
 
 #include "lwip/pbuf.h"
@@ -5,29 +6,46 @@
 
 #include "http.h"
 #include "tcp.h"
+#include "epoch.h"
+#include "scheduler.h"
+#include "ir.h"
+#include "state.h"
 
 
+// All server and connection state lives here, nothing is allocated from the heap at runtime
+static TCP_SERVER_T tcp_server;
+
 /*!
-  * \brief Allocate memory for state structure
+  * \brief Reset the static server state
   * \return Pointer to TCP server state struct
   */
 static TCP_SERVER_T* tcp_server_init(void) {
-    TCP_SERVER_T *state = calloc(1, sizeof(TCP_SERVER_T));
-    state->message_body = (HTTP_MESSAGE_BODY_T*)calloc(1, sizeof(HTTP_MESSAGE_BODY_T));
-    if (!state) {
-        DEBUG_printf("failed to allocate state\n");
-        return NULL;
+    memset(&tcp_server, 0, sizeof(tcp_server));
+    return &tcp_server;
+}
+
+/*!
+  * \brief Claim a free slot from the connection pool, resetting any state left over from the previous request
+  * \param state TCP server state struct
+  * \return Pointer to connection state struct, or NULL if every slot is in use
+  */
+static TCP_CONNECTION_T* tcp_connection_acquire(TCP_SERVER_T *state) {
+    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
+        TCP_CONNECTION_T *conn = &state->connections[i];
+        if (conn->client_pcb != NULL) { continue; }
+        memset(conn, 0, sizeof(TCP_CONNECTION_T));
+        return conn;
     }
-    return state;
+    return NULL;
 }
 
 
 /*!
-  * \brief Shut down TCP client connection
-  * \param arg TCP server state struct
+  * \brief Shut down TCP client connection, returning its slot to the connection pool
+  * \param arg TCP connection state struct
   */
 static err_t tcp_client_close(void *arg) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
     err_t err = ERR_OK;
     if (state->client_pcb == NULL) { return err; }
     tcp_arg(state->client_pcb, NULL);
@@ -60,13 +78,13 @@ static void tcp_server_close(void *arg) {
 /*!
   * \brief TCP send callback, called on each data transfer on the back of a tcp_write(). 
   *        Closes client connection when full length of data has been sent
-  * \param arg TCP server state struct
+  * \param arg TCP connection state struct
   * \param tpcb Client TCP protocol control block
   * \param len Length of data sent
   * \return err_t Success indicator
   */
 static err_t tcp_server_send(void *arg, struct tcp_pcb *tpcb, u16_t len) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
     DEBUG_printf("tcp_server_send %u\n", len);
     state->send_len += len;
 
@@ -82,13 +100,13 @@ static err_t tcp_server_send(void *arg, struct tcp_pcb *tpcb, u16_t len) {
 /*!
   * \brief Send data to client
   * 
-  * \param arg TCP server state struct
+  * \param arg TCP connection state struct
   * \param tpcb Client TCP protocol control block
   * \return err_t Success indicator
   */
 err_t tcp_server_send_data(void *arg, struct tcp_pcb *tpcb)
 {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
 
     state->send_len = 0;
     DEBUG_printf("Writing %ld bytes to client\n", state->payload_len);
@@ -98,20 +116,26 @@ err_t tcp_server_send_data(void *arg, struct tcp_pcb *tpcb)
         DEBUG_printf("Failed to write data %d\n", err);
         return tcp_client_close(arg);
     }
+    // Deferred responses are written from the main loop rather than an lwIP callback, so nothing else flushes them
+    err = tcp_output(tpcb);
+    if (err != ERR_OK) {
+        DEBUG_printf("Failed to output data %d\n", err);
+        return tcp_client_close(arg);
+    }
     return ERR_OK;
 }
 
 /*!
   * \brief Process data received from client, call into http module when full buffer is received
   * 
-  * \param arg TCP server state struct
+  * \param arg TCP connection state struct
   * \param tpcb Client TCP protocol control block
   * \param p Packet buffer
   * \param err Success indicator
   * \return err_t Success indicator
   */
 err_t tcp_server_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
     if (!p) {
         return tcp_client_close(arg);
     }
@@ -119,8 +143,8 @@ err_t tcp_server_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err
     if (p->tot_len > 0) {
         DEBUG_printf("tcp_server_recv %d/%d err %d\n", p->tot_len, state->recv_len, err);
 
-        // Receive the buffer
-        const uint16_t buffer_left = BUF_SIZE - state->recv_len;
+        // Receive the buffer, leaving room for a null terminator as the http module treats it as a string
+        const uint16_t buffer_left = BUF_SIZE - 1 - state->recv_len;
         state->recv_len += pbuf_copy_partial(p, state->buffer_recv + state->recv_len,
                                              p->tot_len > buffer_left ? buffer_left : p->tot_len, 0);
         tcp_recved(tpcb, p->tot_len);
@@ -130,27 +154,81 @@ err_t tcp_server_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err
     if (state->recv_len == p->tot_len) {
         DEBUG_printf("tcp_server_recv buffer ok: %s\n", state->buffer_recv);
         http_process_recv_data(arg);
-        tcp_server_send_data(arg, tpcb);
+        // Long-polls and code requests have nothing to send yet, the main loop responds once there is
+        if (state->payload_len > 0) {
+            tcp_server_send_data(arg, tpcb);
+        }
     }
     pbuf_free(p);
     return ERR_OK;
 }
 
 static err_t tcp_server_poll(void *arg, struct tcp_pcb *tpcb) {
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
     DEBUG_printf("tcp_server_poll_fn\n");
+    // Time out long-polls with an empty event list rather than dropping them
+    if (state->event_wait) {
+        http_events_respond(arg, true);
+        return tcp_server_send_data(arg, tpcb);
+    }
+    if (state->frame_wait) {
+        http_code_respond(arg, true);
+        return tcp_server_send_data(arg, tpcb);
+    }
     return tcp_client_close(arg);
 }
 
+/*!
+  * \brief Count the /events long-polls currently holding a connection slot
+  */
+int tcp_server_event_waiters(void) {
+    int waiters = 0;
+    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
+        if (tcp_server.connections[i].client_pcb != NULL && tcp_server.connections[i].event_wait) { waiters++; }
+    }
+    return waiters;
+}
+
+/*!
+  * \brief Respond to any long-polling /events connections that have new events to report
+  * \param state TCP server state struct
+  */
+static void tcp_server_notify_events(TCP_SERVER_T *state) {
+    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
+        TCP_CONNECTION_T *conn = &state->connections[i];
+        if (conn->client_pcb == NULL || !conn->event_wait) { continue; }
+        if (http_events_respond(conn, false)) {
+            tcp_server_send_data(conn, conn->client_pcb);
+        }
+    }
+}
+
+/*!
+  * \brief Respond to any code requests whose IR frame has finished
+  * \param state TCP server state struct
+  */
+static void tcp_server_notify_frames(TCP_SERVER_T *state) {
+    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
+        TCP_CONNECTION_T *conn = &state->connections[i];
+        if (conn->client_pcb == NULL || !conn->frame_wait) { continue; }
+        if (http_code_respond(conn, false)) {
+            tcp_server_send_data(conn, conn->client_pcb);
+        }
+    }
+}
+
 static void tcp_server_err(void *arg, err_t err) {
+    TCP_CONNECTION_T *state = (TCP_CONNECTION_T*)arg;
     if (err != ERR_ABRT) {
         DEBUG_printf("tcp_client_err_fn %d\n", err);
-        tcp_client_close(arg);
     }
+    // lwIP has already freed the pcb by the time this is called, so just hand the slot back to the pool
+    state->client_pcb = NULL;
 }
 
 
 /*!
-  * \brief Client connect entrypoint, set up client callbacks or abort if request is in-flight
+  * \brief Client connect entrypoint, set up client callbacks or abort if the connection pool is exhausted
   * 
   * \param arg TCP server state struct
   * \param client_pcb Client TCP protocol control block
@@ -160,24 +238,23 @@ static void tcp_server_err(void *arg, err_t err) {
 static err_t tcp_server_accept(void *arg, struct tcp_pcb *client_pcb, err_t err) {
     TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
 
-    // Would need to refactor to be able to handle simultaneous connections or even respond in HTTP,
-    // So just abort any additional connections if one is currently in-flight
-    if (state->client_pcb != NULL) {
-       DEBUG_printf("Connection already in flight, aborting\n");
-       tcp_abort(client_pcb); 
-       return ERR_ABRT;
-    }
-
     if (err != ERR_OK || client_pcb == NULL) {
         DEBUG_printf("Failure in accept\n");
-        tcp_client_close(arg);
         return ERR_VAL;
     }
+
+    // Connection count is fixed at compile time, so abort any additional connections once every slot is in-flight
+    TCP_CONNECTION_T *conn = tcp_connection_acquire(state);
+    if (conn == NULL) {
+       DEBUG_printf("Connection pool exhausted, aborting\n");
+       tcp_abort(client_pcb); 
+       return ERR_ABRT;
+    }
     DEBUG_printf("----------------\n");
     DEBUG_printf("Client connected\n");
 
-    state->client_pcb = client_pcb;
-    tcp_arg(client_pcb, state);
+    conn->client_pcb = client_pcb;
+    tcp_arg(client_pcb, conn);
     tcp_sent(client_pcb, tcp_server_send);
     tcp_recv(client_pcb, tcp_server_recv);
     tcp_poll(client_pcb, tcp_server_poll, POLL_TIME_S * 2);
@@ -209,7 +286,7 @@ static bool tcp_server_open(void *arg) {
         return false;
     }
 
-    state->server_pcb = tcp_listen_with_backlog(pcb, 1);
+    state->server_pcb = tcp_listen_with_backlog(pcb, TCP_MAX_CONNECTIONS);
     if (!state->server_pcb) {
         DEBUG_printf("failed to listen\n");
         if (pcb) {
@@ -225,7 +302,8 @@ static bool tcp_server_open(void *arg) {
 }
 
 /*!
-  * \brief TCP entrypoint, initialise tcp server and wifi. Polls wifi connection periodically to retain connectivity
+  * \brief TCP entrypoint, initialise tcp server, wifi and SNTP. Polls wifi connection periodically to retain connectivity,
+  *        drives the on-device scheduler and pushes IR line events to long-polling clients
   */
 void run_tcp_server(void) {
     if (cyw43_arch_init()) {
@@ -236,27 +314,52 @@ void run_tcp_server(void) {
     cyw43_arch_enable_sta_mode();
 
     TCP_SERVER_T *state = tcp_server_init();
-    if (!state) {
-        return;
-    }
     if (!tcp_server_open(state)) {
-        tcp_client_close(state);
         tcp_server_close(state);
-        free(state->message_body);
-        free(state);
         return;
     }
 
+    cyw43_arch_lwip_begin();
+    epoch_sntp_init();
+    cyw43_arch_lwip_end();
+
+    uint32_t wifi_check_ms = to_ms_since_boot(get_absolute_time()) - WIFI_CHECK_MS;
+    uint32_t wifi_connect_ms = wifi_check_ms - WIFI_CONNECT_TIMEOUT_MS;
+    uint32_t event_seq = 0;
     while(1) {
-        // Wifi appears to disconnect after some time, so re-check connection on a timer
-        if(!cyw43_arch_wifi_connect_timeout_ms(WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK, 30000)) {
-            sleep_ms(10000);
+        // Wifi appears to disconnect after some time, so re-check connection on a timer. The join runs in the background
+        // so scheduled jobs keep firing whilst wifi is down, a join still in progress is only restarted once it times out
+        uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+        if (now_ms - wifi_check_ms >= WIFI_CHECK_MS) {
+            int link_status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+            if (link_status != CYW43_LINK_UP && 
+                (link_status <= CYW43_LINK_DOWN || now_ms - wifi_connect_ms >= WIFI_CONNECT_TIMEOUT_MS)) {
+                DEBUG_printf("wifi link status %d, connecting\n", link_status);
+                cyw43_arch_wifi_connect_async(WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK);
+                wifi_connect_ms = now_ms;
+            }
+            wifi_check_ms = now_ms;
+        }
+
+        // Scheduled jobs fire from here rather than an alarm IRQ as the IR path and flash writes must not race lwIP
+        cyw43_arch_lwip_begin();
+        scheduler_run(epoch_now());
+        scheduler_persist();
+        ir_transmit_poll();
+        ir_receive_poll();
+        tcp_server_notify_frames(state);
+        if (state_event_seq() != event_seq) {
+            event_seq = state_event_seq();
+            tcp_server_notify_events(state);
         }
+        cyw43_arch_lwip_end();
+
+        sleep_ms(SCHEDULER_POLL_MS);
     }
 
-    tcp_client_close(state);
+    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
+        tcp_client_close(&state->connections[i]);
+    }
     tcp_server_close(state);
-    free(state->message_body);
-    free(state);
     cyw43_arch_deinit();
 }
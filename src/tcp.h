@@ -1,18 +1,35 @@
+#pragma once
 #include "snowdon.h"
 #include "http.h"
 
-typedef struct TCP_SERVER_T_ {
-    struct tcp_pcb *server_pcb;
+/*!
+  * \brief Per-connection state, one of these exists for every slot in the static connection pool and is 
+  *        reset each time the slot is handed to a new client
+  */
+typedef struct TCP_CONNECTION_T_ {
     struct tcp_pcb *client_pcb;
     uint8_t buffer_recv[BUF_SIZE];
     uint8_t buffer_send[BUF_SIZE];
     int recv_len;
     int send_len;
     int payload_len;
-    int run_count;
-    HTTP_MESSAGE_BODY_T *message_body;
+    bool event_wait;            // Connection is an /events long-poll waiting for the next state change
+    uint32_t frame_wait;        // Sequence number of the IR frame the response is waiting on, 0 if none
+    uint64_t frame_sent_us;     // Time the frame was queued, in microseconds since boot
+    uint32_t last_gpio;         // RGB LED state before the frame was fired, for codes expected to change it
+    HTTP_MESSAGE_BODY_T message_body;
+} TCP_CONNECTION_T;
+
+typedef struct TCP_SERVER_T_ {
+    struct tcp_pcb *server_pcb;
+    TCP_CONNECTION_T connections[TCP_MAX_CONNECTIONS];
 } TCP_SERVER_T;
 
+/*!
+  * \brief Count the /events long-polls currently holding a connection slot
+  */
+int tcp_server_event_waiters(void);
+
 /*!
   * \brief TCP entrypoint, initialise tcp server and wifi. Polls wifi connection periodically to retain connectivity
   */